@@ -0,0 +1,55 @@
+--[[
+Checks the contours found around holes, no camera needed
+run with: lua example/contour_holes.lua
+]]
+
+kestrel = require "kestrel"
+
+-- makes a binary image from rows of '#' (on) and '.' (off)
+local function draw(rows)
+	local img = kestrel.newimage(1, #rows[1], #rows)
+	for y, row in ipairs(rows) do
+		for x = 1, #row do
+			if row:sub(x, x) == "#" then
+				img:setat(1, x, y, 255)
+			end
+		end
+	end
+	return img
+end
+
+local cases = {
+	-- both pixels beside the hole are on the outer contour too
+	{"one pixel hole", 2, {
+		".......###.......",
+		".......#.#.......",
+		".......###.......",
+	}},
+	{"holes between single pixel runs", 4, {
+		"#######",
+		"#.#.#.#",
+		"#######",
+	}},
+	{"hole in a blob", 2, {
+		"..........",
+		".########.",
+		".##.#####.",
+		".########.",
+		"..........",
+	}},
+	-- the outer contour passes twice through its first pixel
+	{"two arms", 1, {
+		"#####.",
+		"#.....",
+		"#.....",
+		"#.....",
+	}},
+}
+
+for _, case in ipairs(cases) do
+	local name, expected, rows = case[1], case[2], case[3]
+	local found = #kestrel.findcontours(draw(rows))
+
+	assert(found == expected, name .. ": found " .. found .. " contours instead of " .. expected)
+	print(name .. ": " .. found .. " contours")
+end
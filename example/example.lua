@@ -15,11 +15,9 @@ for n=1,100 do
 	-- read frame from camera
 	local img = cam:readframe()
 
-	-- convert frame to hsv
-	local hsv = kestrel.rgb_to_hsv(img)
-
-	-- make a binary thershold image
-	local bin = hsv:inrange({0, 0, 40}, {255, 255, 255})
+	-- make a binary thershold image of the frame in hsv
+	-- same as kestrel.rgb_to_hsv(img):inrange(...) without making the hsv image
+	local bin = kestrel.hsv_inrange(img, {0, 0, 40}, {255, 255, 255})
 
 	-- get image contours
 	local contours = kestrel.findcontours(bin)
@@ -20,6 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define COMMON_H
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
@@ -33,13 +34,24 @@ typedef unsigned char value_t;
 // LIBRARY SETTINGS HANDLE WITH CARE
 
 
-#define CONTOUR_ALLOCATION_SIZE 100
+#define CONTOUR_ALLOCATION_SIZE 100 // bytes of chain code first allocated for a contour (4 steps a byte)
+
+#define POOL_DEFAULT_CAP 		(16 * 1024 * 1024) // bytes of freed images kept for reuse
+
+#define MAX_THREADS 			64
+#define PARALLEL_MIN_PIXELS 	(64 * 1024) // smaller images are processed on the calling thread
+
+#define RECORD_QUEUE_SIZE 		16 // frames waiting to be written before frames are dropped
+
+#define MAX_SYNTHETIC_BLOBS 	1024 // blobs option of a synthetic device
 
 #define DEFAULT_DEVICE_WIDTH 	160
 #define DEFAULT_DEVICE_HEIGHT 	120
+#define DEFAULT_DEVICE_BUFFERS 	2 // v4l2 buffers asked for, the driver may give more
+#define CAPTURE_TIMEOUT 		2 // seconds to wait for a frame
+#define DEVICE_INTERVAL_WINDOW 	1024 // frame intervals kept for percentiles
 
-#define DEFAULT_STEPS_TRACING 	3
+#define DEFAULT_STEPS_TRACING 	1
 
 #define NOISE_COUNT 			8 // correspond to incircling single pixel's 8 neibooghers
-#define STACK_GROWTH 			100
 #endif
@@ -17,39 +17,43 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "contour.h"
+#include "workers.h"
 
-#define IS_BORDER(IMAGE, X, Y) !(get_at(IMAGE, 0, X+1, Y, 0) && \
-	get_at(IMAGE, 0, X, Y+1, 0) && \
-	get_at(IMAGE, 0, X-1, Y, 0) && \
-	get_at(IMAGE, 0, X, Y-1, 0))
-
+#include <pthread.h>
 
 
 // HELPERS
 //----------------------------------------------------------------------------------------------------
 
 /*
-traces a contour using the square tracing method
+traces a contour using the square tracing method,
+going up from the first pixel of a run or down from the last one (the background on the left).
+the path is closed when it leaves the first point the way it first did,
+so a boundary passing twice through its first point is traced whole.
+the trace only depends on the mask, its start and its direction
 */
-static Contour* square_trace(size_t st_x, size_t st_y, Image* img, Image* buffer) {
+static Contour* square_trace(size_t st_x, size_t st_y, Mask* msk, char run_end) {
 	Contour* cnt = make_contour();
 
 	insert_point(cnt, st_x, st_y);
 
-	set_at(buffer, 0, st_x, st_y, 1);
-
-	size_t next_step_x = 0; // go left
-	size_t next_step_y = -1;
+	size_t next_step_x = 0; // go up
+	size_t next_step_y = run_end ? 1 : -1;
 
 	size_t nx_x = st_x + next_step_x;
 	size_t nx_y = st_y + next_step_y;
-	
+
+	size_t first_x 	= 0; // first step
+	size_t first_y 	= 0;
+	char 	moved 	= 0;
+	char 	at_start = 1; // the first point isn't inserted again until the path goes on from it
+
 	// noise cleaner counter
 	int cleaner_counter = 0;
 
 
-	while (!(nx_x == st_x && nx_y == st_y) && cleaner_counter < NOISE_COUNT) {
-		if (get_at(img, 0, nx_x, nx_y, 0) == 0) {
+	while (cleaner_counter < NOISE_COUNT) {
+		if (mask_get(msk, nx_x, nx_y) == 0) {
 
 			// these lines enable 4 connectivity
 			nx_x -= next_step_x;
@@ -65,8 +69,20 @@ static Contour* square_trace(size_t st_x, size_t st_y, Image* img, Image* buffer
 			cleaner_counter++;
 		}
 		else {
-			insert_point(cnt, nx_x, nx_y);
-			set_at (buffer, 0, nx_x, nx_y, 1);
+			if (at_start && moved) {
+				if (next_step_x == first_x && next_step_y == first_y)
+					break;
+				insert_point(cnt, st_x, st_y);
+			}
+			else if (!moved) {
+				first_x = next_step_x;
+				first_y = next_step_y;
+				moved 	= 1;
+			}
+
+			at_start = nx_x == st_x && nx_y == st_y;
+			if (!at_start)
+				insert_point(cnt, nx_x, nx_y);
 
 			size_t tmp 	= next_step_x;
 			next_step_x = next_step_y; // go left
@@ -79,57 +95,467 @@ static Contour* square_trace(size_t st_x, size_t st_y, Image* img, Image* buffer
 		}
 			
 	}
-	// if not noise
-	if (cnt->index >= NOISE_COUNT)
-		return cnt;
-	else { // else clean the noise
-		for (int i = 0; i < cnt->index; i++) 
-			set_at(buffer, 0, cnt->points[i].x, cnt->points[i].y, 0); // erase contour
+	return cnt;
+}
+
+/*
+step from the last point of a closed contour back to its first point
+*/
+static int closing_step(Contour* cnt) {
+	if (cnt->start.x != cnt->last.x)
+		return cnt->start.x > cnt->last.x ? 0 : 2;
+	return cnt->start.y < cnt->last.y ? 1 : 3;
+}
+
+/*
+marks a traced contour on the buffer of points on other contours
+and its points with background on their east side on the east buffer, then returns it.
+going around a point the trace turns right from the left of the step into it
+to the step out of it, every side it turns past is background.
+noise is erased from the buffer and freed
+*/
+static Contour* keep_contour(Contour* cnt, Mask* buffer, Mask* east) {
+	char noise = cnt->index < NOISE_COUNT;
+	int  close = closing_step(cnt);
+	int  in 	= close;
+
+	struct point p = cnt->start;
+	for (size_t i = 0; i < cnt->index; i++) {
+		uint64_t* word = &MASK_ROW(buffer, p.y)[p.x / 64]; // traced points are on the mask
+		uint64_t  bit 	= (uint64_t)1 << (p.x % 64);
+		*word = noise ? *word & ~bit : *word | bit;
+
+		int out 	= i +1 < cnt->index ? CHAIN_STEP(cnt, i) : close;
+		int left 	= (in +1) & 3;
+		if (!noise && left < ((left - out) & 3)) // east (0) is passed turning right from left to out
+			MASK_ROW(east, p.y)[p.x / 64] |= bit;
+
+		if (i +1 < cnt->index) {
+			p.x += CHAIN_DX(out);
+			p.y += CHAIN_DY(out);
+		}
+		in = out;
+	}
+
+	if (noise) {
 		free_contour(cnt);
 		return NULL;
 	}
-
+	return cnt;
 }
 
 /*
-the stack is used to impelement a flood fill algorithm
-the stack is needed in order to calculate the area
-of a contour
+fills the background of buf (w x h, border included) that is 4 connected to its corner with 2,
+returns the amount of pixels filled. pixels are marked when pushed so the stack holds each once
 */
-static struct stack* make_stack(size_t max) {
-	struct stack* stk = calloc(1, sizeof(struct stack*));
+static size_t fill_outside(uint8_t* buf, size_t w, size_t h) {
+	size_t* stack = malloc(w * h * sizeof(size_t));
+	if (stack == NULL) {
+		fprintf(stderr, "Cannot allocate contour area\n");
+		exit(EXIT_FAILURE);
+	}
 
-	stk->size 	= 0;
-	stk->max 	= max;
-	stk->items 	= calloc(max, sizeof(struct point));
+	size_t size 	= 0;
+	size_t filled 	= 0;
+	stack[size++] 	= 0;
+	buf[0] 			= 2;
+
+	while (size > 0) {
+		size_t i = stack[--size];
+		size_t x = i % w;
+		filled++;
+
+		size_t next[4] = {x + 1 < w ? i + 1 : i, x > 0 ? i - 1 : i, i + w, i >= w ? i - w : i};
+		for (int k = 0; k < 4; k++) {
+			if (next[k] < w * h && buf[next[k]] == 0) {
+				buf[next[k]] = 2;
+				stack[size++] = next[k];
+			}
+		}
+	}
 
-	return stk;
+	free(stack);
+	return filled;
 }
 
-static void stack_push(struct stack* stk, struct point p) {
-	if (stk->size != stk->max - 1) 
-		stk->items[stk->size++] = p;
-	else {
-		stk->items = realloc(stk->items, (stk->max + STACK_GROWTH) * sizeof(struct point));
-		if (stk->items != 0) {
-			stk->max += STACK_GROWTH;
-			stk->items[stk->size++] = p;
+/*
+bit of the scratch path mask, 0 outside of it
+*/
+static inline char path_bit(Mask* path, size_t x, size_t y) {
+	return x < path->width && y < path->height && MASK_BIT(path, x, y);
+}
 
+/*
+sets the area of a traced contour (in pixels, the contour included),
+the contour and the background it closes off from the outside (4 connected).
+path is a scratch mask, the points are marked on it and cleared again.
+
+the sides of the points passed on the background (see keep_contour) are the outline
+between the contour and the traced background, each side once.
+summing x +1 for east sides and -x for west sides gives the area on the right of the outline,
+the area of an outer contour or minus the area of a hole (whose points are added).
+a path touching its own pixels diagonally may pass the background on both sides of the touch,
+so it isn't simple and has the background around it filled on its bounding box instead
+*/
+static void measure_area(Contour* cnt, Mask* path) {
+	int 	close 	= closing_step(cnt);
+	int 	in 		= close;
+	int64_t outline = 0;
+	size_t 	pixels 	= 0; // points, the ones passed again counted once
+
+	struct point p = cnt->start;
+	for (size_t i = 0; i < cnt->index; i++) {
+		uint64_t* word 	= &MASK_ROW(path, p.y)[p.x / 64];
+		uint64_t  bit 	= (uint64_t)1 << (p.x % 64);
+		pixels += (*word & bit) == 0;
+		*word |= bit;
+
+		int out 	= i +1 < cnt->index ? CHAIN_STEP(cnt, i) : close;
+		int left 	= (in +1) & 3;
+		for (int turn = 0; turn < ((left - out) & 3); turn++) {
+			int side = (left - turn) & 3;
+			if (side == 0)
+				outline += (int64_t)p.x +1;
+			else if (side == 2)
+				outline -= (int64_t)p.x;
 		}
-		else {
-			fprintf(stderr, "Stack overflow\n");
-			exit(EXIT_FAILURE);
+
+		if (i +1 < cnt->index) {
+			p.x += CHAIN_DX(out);
+			p.y += CHAIN_DY(out);
+		}
+		in = out;
+	}
+
+	// two points touching diagonally with background on both other sides
+	char simple = 1;
+	p = cnt->start;
+	for (size_t i = 0; simple && i < cnt->index; i++) {
+		char below = path_bit(path, p.x, p.y +1);
+		if ((path_bit(path, p.x +1, p.y +1) && !path_bit(path, p.x +1, p.y) && !below) ||
+				(path_bit(path, p.x -1, p.y +1) && !path_bit(path, p.x -1, p.y) && !below))
+			simple = 0;
+
+		if (i +1 < cnt->index) {
+			int step = CHAIN_STEP(cnt, i);
+			p.x += CHAIN_DX(step);
+			p.y += CHAIN_DY(step);
+		}
+	}
+
+	// the points are all within the extremes
+	size_t first_word = cnt->extreme[3].x / 64;
+	size_t last_word  = cnt->extreme[1].x / 64;
+	for (size_t y = cnt->extreme[0].y; y <= cnt->extreme[2].y; y++)
+		memset(MASK_ROW(path, y) + first_word, 0, (last_word - first_word +1) * sizeof(uint64_t));
+
+	cnt->simple = simple;
+	if (simple) {
+		cnt->area = outline > 0 ? (size_t)outline : pixels + (size_t)-outline;
+		return;
+	}
+
+	// the bounding box with a border of background
+	size_t 		left 	= cnt->extreme[3].x;
+	size_t 		top 	= cnt->extreme[0].y;
+	size_t 		w 		= cnt->extreme[1].x - left +3;
+	size_t 		h 		= cnt->extreme[2].y - top +3;
+	uint8_t* 	buf 	= calloc(w * h, 1);
+	if (buf == NULL) {
+		fprintf(stderr, "Cannot allocate contour area\n");
+		exit(EXIT_FAILURE);
+	}
+
+	p = cnt->start;
+	for (size_t i = 0; i < cnt->index; i++) {
+		buf[(p.y - top +1) * w + (p.x - left +1)] = 1;
+
+		if (i +1 < cnt->index) {
+			int step = CHAIN_STEP(cnt, i);
+			p.x += CHAIN_DX(step);
+			p.y += CHAIN_DY(step);
 		}
 	}
+
+	cnt->area = w * h - fill_outside(buf, w, h);
+	free(buf);
 }
 
-static struct point stack_pop(struct stack* stk) {
-	if (stk->size > 0)
-		return stk->items[--stk->size];
+/*
+traces of a strip of rows, traced on a worker against buffers of its own.
+a trace is keyed by its start and direction (see trace_start)
+*/
+struct strip {
+	size_t 		y0, y1;
+	Mask* 		buffer; // points on traced contours
+	Mask* 		east; 	// points with their east side on a traced contour
+	Mask* 		path; 	// scratch for measuring areas, left empty
+	Contour** 	cnts;
+	size_t* 	keys;
+	size_t 		amount;
+};
+
+struct strips {
+	Mask* 			msk;
+	size_t 			steps_y;
+	pthread_mutex_t lock;
+	struct strip 	items[MAX_THREADS];
+	size_t 			count;
+};
+
+static void make_strip(struct strip* strip, Mask* msk, size_t y0, size_t y1) {
+	memset(strip, 0, sizeof(struct strip));
+	strip->y0 		= y0;
+	strip->y1 		= y1;
+	strip->buffer 	= make_mask(msk->width, msk->height);
+	strip->east 	= make_mask(msk->width, msk->height);
+	strip->path 	= make_mask(msk->width, msk->height);
+}
+
+static void free_strip(struct strip* strip) {
+	for (size_t i = 0; i < strip->amount; i++) // traces of contours already found
+		if (strip->cnts[i])
+			free_contour(strip->cnts[i]);
+	free(strip->cnts);
+	free(strip->keys);
+	free_mask(strip->buffer);
+	free_mask(strip->east);
+	free_mask(strip->path);
+}
+
+/*
+traces from (x, y) up or down, reusing the trace of the same start of a strip (in raster order)
+and appends the contour to out unless it is noise.
+new traces are measured here, so the area of a contour is measured once
+*/
+static void trace_start(Mask* msk, struct strip* out, size_t x, size_t y, char down,
+		struct strip* traced, size_t* next) {
+
+	size_t 		key = (y * msk->width + x) * 2 + down;
+	Contour* 	cnt = NULL;
+
+	if (traced) {
+		while (*next < traced->amount && traced->keys[*next] < key)
+			(*next)++;
+		if (*next < traced->amount && traced->keys[*next] == key) {
+			cnt = traced->cnts[*next];
+			traced->cnts[(*next)++] = NULL;
+		}
+	}
+	if (cnt == NULL) {
+		cnt = square_trace(x, y, msk, down);
+		if (cnt->index >= NOISE_COUNT)
+			measure_area(cnt, out->path);
+	}
+
+	cnt = keep_contour(cnt, out->buffer, out->east);
+	if (cnt == NULL)
+		return;
+
+	Contour** 	tmp_cnts = realloc(out->cnts, (out->amount +1) * sizeof(Contour*));
+	size_t* 	tmp_keys = realloc(out->keys, (out->amount +1) * sizeof(size_t));
+	if (tmp_cnts != 0 && tmp_keys != 0) {
+		out->cnts = tmp_cnts;
+		out->keys = tmp_keys;
+		out->cnts[out->amount] = cnt;
+		out->keys[out->amount] = key;
+		out->amount++;
+	}
 	else {
-		fprintf(stderr, "Stack underflow\n");
+		fprintf(stderr, "Not enough space to find contours\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*
+traces the contours starting on the scanned rows in [y0, y1), appending them to out.
+every steps_y row is scanned a word at a time and empty words are skipped.
+outer contours are traced up from the first pixels of runs not on a contour yet
+and holes down from the last pixels of runs, when the background east of them
+isn't on a contour yet (a pixel left of a hole may be on the outer contour too).
+
+traces of a strip are reused instead of tracing the same start again
+*/
+static void scan_rows(Mask* msk, struct strip* out, size_t y0, size_t y1, size_t steps_y, struct strip* traced) {
+	size_t words 	= MASK_WORDS(msk->width);
+	size_t next 	= 0; // next trace of the strip
+
+	for (size_t i = (y0 + steps_y -1) / steps_y * steps_y; i < y1; i += steps_y) {
+		const uint64_t* row 	= MASK_ROW(msk, i);
+		const uint64_t* seen 	= MASK_ROW(out->buffer, i);
+		const uint64_t* east 	= MASK_ROW(out->east, i);
+
+		for (size_t k = 0; k < words; k++) {
+			uint64_t word = row[k];
+			if (word == 0) // empty words are skipped
+				continue;
+
+			uint64_t left 	= (word << 1) | (k > 0 ? row[k -1] >> 63 : 0);
+			uint64_t right 	= (word >> 1) | (k +1 < words ? row[k +1] << 63 : 0);
+			uint64_t firsts = word & ~left; // first pixels of runs
+			uint64_t ends 	= word & ~right; // and last pixels
+			uint64_t edges 	= firsts | ends;
+
+			// the buffers are read again before every trace, a trace may pass through this word
+			while (edges != 0) {
+				int 		bit = __builtin_ctzll(edges);
+				uint64_t 	b 	= (uint64_t)1 << bit;
+				edges &= edges -1;
+
+				if ((firsts & b) && !(seen[k] & b))
+					trace_start(msk, out, k * 64 + bit, i, 0, traced, &next);
+				if ((ends & b) && !(east[k] & b))
+					trace_start(msk, out, k * 64 + bit, i, 1, traced, &next);
+			}
+		}
+	}
+}
+
+/*
+band function tracing a strip on its own (see workers.c)
+*/
+static void trace_band(void* ctx, size_t y0, size_t y1) {
+	struct strips* 	strips = ctx;
+	struct strip 	strip;
+
+	make_strip(&strip, strips->msk, y0, y1);
+	scan_rows(strips->msk, &strip, y0, y1, strips->steps_y, NULL);
+
+	pthread_mutex_lock(&strips->lock);
+	strips->items[strips->count++] = strip;
+	pthread_mutex_unlock(&strips->lock);
+}
+
+static int compare_strips(const void* a, const void* b) {
+	const struct strip* s1 = a;
+	const struct strip* s2 = b;
+	return (s1->y0 > s2->y0) - (s1->y0 < s2->y0);
+}
+
+/*
+adds the step from (x, y) to the green's theorem sums of the moments.
+an edge (x0, y0) -> (x1, y1) adds c = x0 y1 - x1 y0 times
+1, x0 + x1, x0^2 + x0 x1 + x1^2, x0 y1 + 2 x0 y0 + 2 x1 y1 + x1 y0,
+(x0 + x1)(x0^2 + x1^2), x0^2 (3 y0 + y1) + 2 x0 x1 (y0 + y1) + x1^2 (y0 + 3 y1) and their mirrors,
+which shrink a lot as a step keeps either x or y
+*/
+static void add_step(double* green, double x, double y, int step) {
+	double d = step < 2 ? 1 : -1; // east and north
+
+	if ((step & 1) == 0) { // along x
+		double c 	= -d * y;
+		double s 	= 2 * x + d; 				// x0 + x1
+		double q 	= 3 * x * x + 3 * d * x + 1; // x0^2 + x0 x1 + x1^2
+		double cy 	= c * y;
+
+		green[0] += c;
+		green[1] += c * s;
+		green[2] += 2 * cy;
+		green[3] += c * q;
+		green[4] += 3 * cy * s;
+		green[5] += 3 * cy * y;
+		green[6] += c * s * (2 * x * x + 2 * d * x + 1);
+		green[7] += 4 * cy * q;
+		green[8] += 6 * cy * y * s;
+		green[9] += 4 * cy * y * y;
+	}
+	else { // along y, north is -y
+		double c 	= -d * x;
+		double s 	= 2 * y - d; 				// y0 + y1
+		double q 	= 3 * y * y - 3 * d * y + 1; // y0^2 + y0 y1 + y1^2
+		double cx 	= c * x;
+
+		green[0] += c;
+		green[1] += 2 * cx;
+		green[2] += c * s;
+		green[3] += 3 * cx * x;
+		green[4] += 3 * cx * s;
+		green[5] += c * q;
+		green[6] += 4 * cx * x * x;
+		green[7] += 6 * cx * x * s;
+		green[8] += 4 * cx * q;
+		green[9] += c * s * (2 * y * y - 2 * d * y + 1);
+	}
+}
+
+/*
+moments relative to the first point of the closed polygon,
+positive whichever way the contour was traced.
+the closing edge ends on the first point and adds nothing
+*/
+static void relative_moments(Contour* cnt, double* m) {
+	const double scale[10] = {2, 6, 6, 12, 24, 12, 20, 60, 60, 20};
+
+	double sign = cnt->green[0] < 0 ? -1 : 1;
+	for (int i = 0; i < 10; i++)
+		m[i] = sign * cnt->green[i] / scale[i];
+}
+
+/*
+returns the first x from x on whose bit differs from flip (0 for set bits, ~0 for cleared bits),
+width if there is none. whole words of flip are skipped at once
+*/
+static size_t next_bit(const uint64_t* row, size_t width, size_t x, uint64_t flip) {
+	size_t words = MASK_WORDS(width);
+	size_t k 	 = x / 64;
+	if (k >= words)
+		return width;
+
+	uint64_t word = (row[k] ^ flip) & (~(uint64_t)0 << (x % 64));
+	while (word == 0) {
+		if (++k == words)
+			return width;
+		word = row[k] ^ flip;
+	}
+
+	size_t found = k * 64 + __builtin_ctzll(word);
+	return found < width ? found : width;
+}
+
+/*
+a run of set bits [x0, x1) in row y, label is its provisional label
+*/
+struct run {
+	size_t 		x0, x1, y;
+	uint32_t 	label;
+};
+
+/*
+statistics summed over the runs of a provisional label
+*/
+struct blob {
+	uint64_t 	area, sum_x, sum_y;
+	size_t 		left, top, right, bottom;
+};
+
+static uint32_t find_root(uint32_t* parent, uint32_t label) {
+	while (parent[label] != label) {
+		parent[label] = parent[parent[label]]; // path halving
+		label = parent[label];
+	}
+	return label;
+}
+
+/*
+the smaller label becomes the root, so roots keep the scan order of the blobs
+*/
+static void unite(uint32_t* parent, uint32_t a, uint32_t b) {
+	a = find_root(parent, a);
+	b = find_root(parent, b);
+	if (a < b)
+		parent[b] = a;
+	else
+		parent[a] = b;
+}
+
+static void* grow(void* items, size_t* max, size_t size) {
+	*max = *max ? *max * 2 : 64;
+	items = realloc(items, *max * size);
+	if (items == NULL) {
+		fprintf(stderr, "Not enough space to find components\n");
 		exit(EXIT_FAILURE);
 	}
+	return items;
 }
 
 //----------------------------------------------------------------------------------------------------
@@ -140,12 +566,13 @@ static struct point stack_pop(struct stack* stk) {
 Contour* make_contour() {
 	size_t size = CONTOUR_ALLOCATION_SIZE;
 
-	struct point* points = calloc(size, sizeof(struct point));
+	uint8_t* chain = calloc(size, 1);
 
-	if (points != 0) {
+	if (chain != 0) {
 		Contour* cnt = malloc(sizeof(Contour));
 
-		cnt->points = points;
+		memset(cnt, 0, sizeof(Contour));
+		cnt->chain 	= chain;
 		cnt->size 	= size;
 		cnt->index 	= 0;
 		return cnt;
@@ -156,41 +583,99 @@ Contour* make_contour() {
 	}
 }
 
-void insert_point(Contour* cnt, size_t x, size_t y) {
-	if (cnt->index < cnt->size) {
-		struct point p 			= {x, y};
-		cnt->points[cnt->index] = p;
+/*
+inserts a point and updates the extremes and sums of the contour,
+points after the first must be 4 neighbours of the last one.
+returns 0 and leaves the contour as it was for any other point
+*/
+char insert_point(Contour* cnt, size_t x, size_t y) {
+	struct point p = {x, y};
 
-		cnt->index++;
+	if (cnt->index == 0) {
+		cnt->start = p;
+		for (int i = 0; i < 4; i++)
+			cnt->extreme[i] = p;
 	}
 	else {
-		struct point* tmp = realloc(cnt->points, sizeof(struct point) * (cnt->size + CONTOUR_ALLOCATION_SIZE));
-		if (tmp != 0) {
-			cnt->points 			= tmp;
-			cnt->size 				+= CONTOUR_ALLOCATION_SIZE;
-			struct point p 			= {x, y};
-			cnt->points[cnt->index] = p;
-
-			cnt->index++;
-		}
-		else {
-			fprintf(stderr, "Cannot resize contour\n");
-			exit(EXIT_FAILURE);
+		// steps by (dx +1) + 3 (dy +1)
+		static const int steps[9] = {-1, 1, -1, 2, -1, 0, -1, 3, -1};
+
+		size_t dx = x - cnt->last.x +1;
+		size_t dy = y - cnt->last.y +1;
+		int step = dx < 3 && dy < 3 ? steps[dx + 3 * dy] : -1;
+
+		if (step < 0)
+			return 0;
+
+		// the chain grows geometrically
+		size_t i = cnt->index -1;
+		if (i / 4 == cnt->size) {
+			uint8_t* tmp = realloc(cnt->chain, cnt->size * 2);
+			if (tmp != 0) {
+				memset(tmp + cnt->size, 0, cnt->size);
+				cnt->chain 	= tmp;
+				cnt->size 	*= 2;
+			}
+			else {
+				fprintf(stderr, "Cannot resize contour\n");
+				exit(EXIT_FAILURE);
+			}
 		}
+		cnt->chain[i / 4] |= step << (i % 4 * 2);
+
+		// remeber that y up --> down
+		if (y < cnt->extreme[0].y) // found N
+			cnt->extreme[0] = p;
+		if (x > cnt->extreme[1].x) // found E
+			cnt->extreme[1] = p;
+		if (y > cnt->extreme[2].y) // found S
+			cnt->extreme[2] = p;
+		if (x < cnt->extreme[3].x) // found W
+			cnt->extreme[3] = p;
+
+		struct point* first = &cnt->start;
+		struct point* last 	= &cnt->last;
+		add_step(cnt->green, (double)last->x - first->x, (double)last->y - first->y, step);
 	}
+
+	cnt->sum_x 	+= x;
+	cnt->sum_y 	+= y;
+	cnt->sum_xx += (uint64_t)x * x;
+	cnt->sum_xy += (uint64_t)x * y;
+	cnt->sum_yy += (uint64_t)y * y;
+
+	cnt->last = p;
+	cnt->index++;
+	return 1;
 }
 
 void free_contour(Contour* cnt) {
-	free(cnt->points);
+	free(cnt->chain);
 	free(cnt);
 }
 
+/*
+decodes the chain of a contour into points, which must have room for all of them
+*/
+void contour_points(Contour* cnt, struct point* points) {
+	struct point p = cnt->start;
+
+	for (size_t i = 0; i < cnt->index; i++) {
+		points[i] = p;
+		if (i +1 < cnt->index) {
+			int step = CHAIN_STEP(cnt, i);
+			p.x += CHAIN_DX(step);
+			p.y += CHAIN_DY(step);
+		}
+	}
+}
+
 
 /*
-find the contours in a binary image using square trace with 4 connectivity
-set steps to 1 for full precision at the price of speed.
+find the contours in a binary image using square trace with 4 connectivity,
+steps_y above 1 skips rows at the price of precision, steps_x is ignored
 
-recommended 3 steps 
+the image is packed into a mask and traced with find_contours_mask
 */
 Contour** find_contours(Image* img, size_t* index_size, size_t steps_x, size_t steps_y) {
 
@@ -201,37 +686,10 @@ Contour** find_contours(Image* img, size_t* index_size, size_t steps_x, size_t s
 	}
 
 	if (img->channels == 1) {
+		Mask* 		msk 	= image_to_mask(img);
+		Contour** 	cnts 	= find_contours_mask(msk, index_size, steps_x, steps_y);
 
-		Image* 		buffer 	= make_image(1, img->width, img->height); // keep track of points on other contours
-		Contour** 	cnts 	= malloc(sizeof(Contour**));
-		size_t 		amount 	= 0;
-
-		for (int i = 0; i < img->height; i += steps_y) {
-			for (int j = 0; j < img->width; j += steps_x) {
-				if (get_at(img, 0, j, i, 0) != 0 &&
-						get_at (buffer, 0, j, i, 0) == 0 &&
-						IS_BORDER(img, j, i)) { // only borders remain
-
-					Contour* cnt = square_trace(j, i, img, buffer); // traces the border
-					if (cnt) {
-						Contour** tmp = realloc(cnts, (amount +1) * sizeof(Contour*));
-						if (tmp != 0) {
-							cnts = tmp;
-							cnts[amount] = cnt;
-							amount++;
-						}
-						else {
-							fprintf(stderr, "Not enough space to find contours\n");
-							exit(EXIT_FAILURE);
-						}
-					}
-				}
-			}
-		}
-
-		*index_size = amount;
-
-		free_image(buffer);
+		free_mask(msk);
 		return cnts;
 	}
 	else {
@@ -241,112 +699,244 @@ Contour** find_contours(Image* img, size_t* index_size, size_t steps_x, size_t s
 	}
 }
 
-//----------------------------------------------------------------------------------------------------
+/*
+every steps_y row is scanned for starts of contours (see scan_rows),
+since every run edge of a scanned row is tried thin objects aren't missed.
+steps_x is ignored, it is kept so callers don't break.
 
-// CONTOUR CALCULATION
-//----------------------------------------------------------------------------------------------------
+strips of rows are traced on the workers, each as if it were alone,
+then the strips are scanned again in order against one buffer reusing their traces.
+contours crossing seams are found once and in the same order as a serial scan
+*/
+Contour** find_contours_mask(Mask* msk, size_t* index_size, size_t steps_x, size_t steps_y) {
 
-void contour_center(Contour* cnt, float* x, float* y) {
-	float sum_x = 0;
-	float sum_y = 0;
-	for (int i = 0; i < cnt->index; i++) {
-		sum_x += cnt->points[i].x;
-		sum_y += cnt->points[i].y;
+	if (steps_x < 1 || steps_y < 1) {
+		fprintf(stderr, "Tracing steps must be equal or greater than 1");
+		*index_size = 0;
+		return NULL;
+	}
+
+	struct strips strips = {.msk = msk, .steps_y = steps_y, .lock = PTHREAD_MUTEX_INITIALIZER};
+	workers_run(trace_band, &strips, msk->width, msk->height);
+
+	// a single strip was the whole mask
+	if (strips.count == 1) {
+		struct strip* strip = &strips.items[0];
+		Contour** cnts = strip->cnts;
+
+		*index_size = strip->amount;
+		strip->amount 	= 0;
+		strip->cnts 	= NULL;
+		free_strip(strip);
+		return cnts;
 	}
-	*x = sum_x / cnt->index;
-	*y = sum_y / cnt->index;
+
+	qsort(strips.items, strips.count, sizeof(struct strip), compare_strips);
+
+	struct strip merged; // keeps track of points on other contours
+	make_strip(&merged, msk, 0, msk->height);
+
+	for (size_t i = 0; i < strips.count; i++) {
+		struct strip* strip = &strips.items[i];
+		scan_rows(msk, &merged, strip->y0, strip->y1, steps_y, strip);
+		free_strip(strip);
+	}
+
+	Contour** cnts = merged.cnts;
+
+	*index_size = merged.amount;
+	merged.amount 	= 0;
+	merged.cnts 	= NULL;
+	free_strip(&merged);
+	return cnts;
 }
 
 /*
-return the extreme points of a contour
-order: N E S W
+labels the connected components of a binary image in a single scan over its runs,
+with 4 connectivity or with 8 connectivity if eight is set.
+returns the components in the order their first pixel is met (top to bottom, left to right).
+
+if labels isn't NULL it's set to an array of a label per pixel, row after row,
+0 for the background and i +1 for the component i
+
+the image is packed into a mask and labeled with find_components_mask
 */
-struct point* get_contour_extreme(Contour* cnt) {
-	struct point* result = calloc(4, sizeof(struct point));
+struct component* find_components(Image* img, size_t* amount, char eight, uint32_t** labels) {
+	if (img->channels == 1) {
+		Mask* 				msk 	= image_to_mask(img);
+		struct component* 	comps 	= find_components_mask(msk, amount, eight, labels);
 
-	for (int i = 0; i < 4; i++) {
-		result[i].x = cnt->points[0].x;
-		result[i].y = cnt->points[1].y;
+		free_mask(msk);
+		return comps;
 	}
-	
-	// remeber that y up --> down
-	for (int i = 0; i < cnt->index; i++) {
-		if (result[0].y > cnt->points[i].y) { // found N
-			result[0].x = cnt->points[i].x;
-			result[0].y = cnt->points[i].y;
+	else {
+		fprintf(stderr, "Components for one channel images only\n");
+		*amount = 0;
+		return NULL;
+	}
+}
+
+/*
+runs of a row are united with the runs of the row above that touch them,
+diagonally too with 8 connectivity
+*/
+struct component* find_components_mask(Mask* msk, size_t* amount, char eight, uint32_t** labels) {
+	struct run* 	runs 		= NULL;
+	struct blob* 	blobs 		= NULL;
+	uint32_t* 		parent 		= NULL;
+	size_t 			n_runs 		= 0, max_runs = 0;
+	size_t 			n_labels 	= 0, max_labels = 0;
+	size_t 			above 		= 0, above_end = 0; // runs of the row above
+
+	for (size_t y = 0; y < msk->height; y++) {
+		const uint64_t* row 		= MASK_ROW(msk, y);
+		size_t 			row_start 	= n_runs;
+		size_t 			x 			= next_bit(row, msk->width, 0, 0);
+
+		while (x < msk->width) {
+			size_t end = next_bit(row, msk->width, x, ~(uint64_t)0);
+
+			if (n_runs == max_runs)
+				runs = grow(runs, &max_runs, sizeof(struct run));
+			struct run* run = &runs[n_runs++];
+			run->x0 = x;
+			run->x1 = end;
+			run->y 	= y;
+
+			// runs above that end before this one starts can't touch any later run
+			while (above < above_end && runs[above].x1 + eight <= x)
+				above++;
+
+			uint32_t label = 0;
+			for (size_t k = above; k < above_end && runs[k].x0 < end + eight; k++) {
+				if (label == 0)
+					label = runs[k].label;
+				else
+					unite(parent, label, runs[k].label);
+			}
+
+			// a run touching nothing above starts a new label
+			if (label == 0) {
+				if (n_labels +1 >= max_labels) {
+					size_t max = max_labels;
+					parent 	= grow(parent, &max_labels, sizeof(uint32_t));
+					blobs 	= grow(blobs, &max, sizeof(struct blob));
+				}
+				label = ++n_labels;
+				parent[label] 	= label;
+				blobs[label] 	= (struct blob){0, 0, 0, x, y, end -1, y};
+			}
+			run->label = label;
+
+			struct blob* b 	= &blobs[label];
+			size_t 		 n 	= end - x;
+			b->area 	+= n;
+			b->sum_x 	+= (uint64_t)(x + end -1) * n / 2;
+			b->sum_y 	+= (uint64_t)y * n;
+			b->left 	= (x < b->left ? x : b->left);
+			b->right 	= (end -1 > b->right ? end -1 : b->right);
+			b->bottom 	= y;
+
+			x = next_bit(row, msk->width, end, 0);
 		}
 
-		if (result[1].x < cnt->points[i].x) { // found E
-			result[1].x = cnt->points[i].x;
-			result[1].y = cnt->points[i].y;
-			
+		above 		= row_start;
+		above_end 	= n_runs;
+	}
+
+	// provisional labels are merged into their roots, roots get the final labels in order
+	uint32_t* final = calloc(n_labels +1, sizeof(uint32_t));
+	struct component* comps = malloc((n_labels +1) * sizeof(struct component));
+	if (final == NULL || comps == NULL) {
+		fprintf(stderr, "Not enough space to find components\n");
+		exit(EXIT_FAILURE);
+	}
+
+	size_t count = 0;
+	for (uint32_t l = 1; l <= n_labels; l++) {
+		uint32_t root = find_root(parent, l);
+		if (root == l) {
+			final[l] = ++count;
+			continue;
 		}
 
-		if (result[2].y < cnt->points[i].y) { // found S
-			result[2].x = cnt->points[i].x;
-			result[2].y = cnt->points[i].y;
-		
+		struct blob* r = &blobs[root];
+		struct blob* b = &blobs[l];
+		r->area 	+= b->area;
+		r->sum_x 	+= b->sum_x;
+		r->sum_y 	+= b->sum_y;
+		r->left 	= (b->left < r->left ? b->left : r->left);
+		r->top 		= (b->top < r->top ? b->top : r->top);
+		r->right 	= (b->right > r->right ? b->right : r->right);
+		r->bottom 	= (b->bottom > r->bottom ? b->bottom : r->bottom);
+	}
+
+	for (uint32_t l = 1; l <= n_labels; l++) {
+		if (final[l] == 0)
+			continue;
+
+		struct blob* b 		= &blobs[l];
+		struct component* c = &comps[final[l] -1];
+		c->area 	= b->area;
+		c->x 		= (float)b->sum_x / b->area;
+		c->y 		= (float)b->sum_y / b->area;
+		c->left 	= b->left;
+		c->top 		= b->top;
+		c->right 	= b->right;
+		c->bottom 	= b->bottom;
+	}
+
+	if (labels) {
+		*labels = calloc(msk->width * msk->height, sizeof(uint32_t));
+		if (*labels == NULL) {
+			fprintf(stderr, "Not enough space to find components\n");
+			exit(EXIT_FAILURE);
 		}
 
-		if (result[3].x > cnt->points[i].x) { // found W
-			result[3].x = cnt->points[i].x;
-			result[3].y = cnt->points[i].y;
-		
+		for (size_t i = 0; i < n_runs; i++) {
+			uint32_t 	label 	= final[find_root(parent, runs[i].label)];
+			uint32_t* 	row 	= *labels + runs[i].y * msk->width;
+			for (size_t x = runs[i].x0; x < runs[i].x1; x++)
+				row[x] = label;
 		}
 	}
 
+	free(runs);
+	free(blobs);
+	free(parent);
+	free(final);
+
+	*amount = count;
+	return comps;
+}
+
+//----------------------------------------------------------------------------------------------------
+
+// CONTOUR CALCULATION
+//----------------------------------------------------------------------------------------------------
+
+void contour_center(Contour* cnt, float* x, float* y) {
+	*x = (float)cnt->sum_x / cnt->index;
+	*y = (float)cnt->sum_y / cnt->index;
+}
+
+/*
+return the extreme points of a contour
+order: N E S W
+*/
+struct point* get_contour_extreme(Contour* cnt) {
+	struct point* result = calloc(4, sizeof(struct point));
+
+	memcpy(result, cnt->extreme, 4 * sizeof(struct point));
+
 	return result;
 }
 
 /*
-calculate area by plotting the contour and using flood fill 
-to count area outside the contour and subtracting it
-from the area of the buffer
+the area in pixels measured when the contour was traced (see measure_area)
 */
 size_t get_contour_area(Contour* cnt) {
-	struct point* exp = get_contour_extreme(cnt);
-
-	size_t cnt_w = exp[1].x - exp[3].x +1;
-	size_t cnt_h = exp[2].y - exp[0].y +1;
-
-	Image* buffer = make_image(1, cnt_w +2, cnt_h +2);
-
-	size_t area = (cnt_w +2) * (cnt_h +2);
-
-	for (int i = 0; i < cnt->index; i++)
-		set_at(buffer, 0, cnt->points[i].x -exp[3].x +1, cnt->points[i].y -exp[0].y +1, 1);
-
-	struct stack* 	stk = make_stack(area);
-	struct point 	p 	= {0, 0};
-	stack_push(stk, p);
-
-	while (stk->size > 0) {
-		struct point p = stack_pop(stk);
-		
-		size_t x = p.x;
-		size_t y = p.y;
-
-		if (get_at(buffer, 0, x, y, 1) == 0) {
-			set_at(buffer, 0, x, y, 2);
-			area--;
-			struct point p1 = {x +1, y};
-			struct point p2 = {x -1, y};
-			struct point p3 = {x, y +1};
-			struct point p4 = {x, y -1};
-			stack_push(stk, p1);
-			stack_push(stk, p2);
-			stack_push(stk, p3);
-			stack_push(stk, p4);
-		
-		} 
-	}
-	
-	free_image(buffer);
-
-	free(stk->items);
-	free(stk);
-	free(exp);
-	return area;
+	return cnt->area;
 }
 
 /*
@@ -355,21 +945,101 @@ y = m*x + b
 for the given contour
 */
 void fit_line(Contour* cnt, float* m, float* b) {
-	float sum_x 	= 0;
-	float sum_y 	= 0; 
-	float sum_xy 	= 0;
-	float sum_x2 	= 0; 
-
-	for (int i = 0; i < cnt->index; i++) { 
-		sum_x 	+= cnt->points[i].x; 
-		sum_y 	+= cnt->points[i].y; 
-		sum_xy 	+= cnt->points[i].x * cnt->points[i].y; 
-		sum_x2 	+= (cnt->points[i].x * cnt->points[i].x); 
-	} 
+	float sum_x 	= cnt->sum_x;
+	float sum_y 	= cnt->sum_y;
+	float sum_xy 	= cnt->sum_xy;
+	float sum_x2 	= cnt->sum_xx;
 
 	*m = (cnt->index * sum_xy - sum_x * sum_y) / (cnt->index * sum_x2 - (sum_x * sum_x)); 
 	*b = (sum_y - (*m) * sum_x) / cnt->index; 
 	
 }
 
+/*
+moments of the polygon through the points, which are all 0 for contours without an inside
+*/
+void contour_moments(Contour* cnt, struct moments* m) {
+	memset(m, 0, sizeof(struct moments));
+
+	double r[10];
+	if (cnt->index == 0)
+		return;
+	relative_moments(cnt, r);
+	if (r[0] == 0)
+		return;
+
+	// centroid relative to the first point
+	double cx = r[1] / r[0];
+	double cy = r[2] / r[0];
+
+	m->mu20 = r[3] - cx * r[1];
+	m->mu11 = r[4] - cx * r[2];
+	m->mu02 = r[5] - cy * r[2];
+	m->mu30 = r[6] - 3 * cx * r[3] + 2 * cx * cx * r[1];
+	m->mu21 = r[7] - 2 * cx * r[4] - cy * r[3] + 2 * cx * cx * r[2];
+	m->mu12 = r[8] - 2 * cy * r[4] - cx * r[5] + 2 * cy * cy * r[1];
+	m->mu03 = r[9] - 3 * cy * r[5] + 2 * cy * cy * r[2];
+
+	// raw moments are shifted from the first point to the origin
+	double ox = cnt->start.x;
+	double oy = cnt->start.y;
+
+	m->m00 = r[0];
+	m->m10 = r[1] + ox * r[0];
+	m->m01 = r[2] + oy * r[0];
+	m->m20 = r[3] + 2 * ox * r[1] + ox * ox * r[0];
+	m->m11 = r[4] + ox * r[2] + oy * r[1] + ox * oy * r[0];
+	m->m02 = r[5] + 2 * oy * r[2] + oy * oy * r[0];
+}
+
+/*
+angle in radians of the major axis from the x axis (y up --> down),
+contours without an inside use the spread of their points
+*/
+float contour_orientation(Contour* cnt) {
+	struct moments m;
+	contour_moments(cnt, &m);
+
+	if (m.m00 == 0 && cnt->index > 0) {
+		double n 	= cnt->index;
+		double mx 	= cnt->sum_x / n;
+		double my 	= cnt->sum_y / n;
+		m.mu20 = cnt->sum_xx - n * mx * mx;
+		m.mu11 = cnt->sum_xy - n * mx * my;
+		m.mu02 = cnt->sum_yy - n * my * my;
+	}
+
+	return 0.5 * atan2(2 * m.mu11, m.mu20 - m.mu02);
+}
+
+/*
+sets hu to the 7 hu moments of the contour,
+invariant to translation, scale and rotation (the last one changes sign on reflection)
+*/
+void contour_hu_moments(Contour* cnt, double* hu) {
+	struct moments m;
+	contour_moments(cnt, &m);
+
+	if (m.m00 == 0) {
+		memset(hu, 0, 7 * sizeof(double));
+		return;
+	}
+
+	// normalized central moments
+	double s2 = m.m00 * m.m00;
+	double s3 = s2 * sqrt(m.m00);
+	double n20 = m.mu20 / s2, n11 = m.mu11 / s2, n02 = m.mu02 / s2;
+	double n30 = m.mu30 / s3, n21 = m.mu21 / s3, n12 = m.mu12 / s3, n03 = m.mu03 / s3;
+
+	double a = n30 + n12, b = n21 + n03;
+
+	hu[0] = n20 + n02;
+	hu[1] = (n20 - n02) * (n20 - n02) + 4 * n11 * n11;
+	hu[2] = (n30 - 3 * n12) * (n30 - 3 * n12) + (3 * n21 - n03) * (3 * n21 - n03);
+	hu[3] = a * a + b * b;
+	hu[4] = (n30 - 3 * n12) * a * (a * a - 3 * b * b) + (3 * n21 - n03) * b * (3 * a * a - b * b);
+	hu[5] = (n20 - n02) * (a * a - b * b) + 4 * n11 * a * b;
+	hu[6] = (3 * n21 - n03) * a * (a * a - 3 * b * b) - (n30 - 3 * n12) * b * (3 * a * a - b * b);
+}
+
 //----------------------------------------------------------------------------------------------------
@@ -21,30 +21,75 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "common.h"
 #include "image.h"
+#include "mask.h"
 
 struct point {
 	size_t x, y;
 };
 
-struct stack{
-	size_t 			max;
-	size_t 			size;
-	struct point* 	items;
+/*
+spatial moments of the polygon through the points of a contour,
+raw moments are about the image origin
+*/
+struct moments {
+	double m00, m10, m01, m20, m11, m02;
+	double mu20, mu11, mu02, mu30, mu21, mu12, mu03; // central
 };
 
+/*
+a contour is stored as its first point and a freeman chain code of the 4 connected steps between its points,
+2 bits a step and 4 steps a byte (see CHAIN_STEP).
+it keeps its extremes, the sums of its points and the green's theorem sums
+of the path through them (relative to the first point) as points are inserted
+*/
 typedef struct {
-	struct point* 	points;
-	size_t 			size, index;
+	struct point 	start, last;
+	uint8_t* 		chain;
+	size_t 			size, index; // bytes of the chain, amount of points
+
+	struct point 	extreme[4]; // N E S W
+	uint64_t 		sum_x, sum_y, sum_xx, sum_xy, sum_yy;
+	double 			green[10]; // 2 m00, 6 m10, 6 m01, 12 m20, 24 m11, 12 m02, 20 m30, 60 m21, 60 m12, 20 m03
+
+	char 			simple; // the path never touches its own pixels diagonally, its outline bounds its area
+	size_t 			area; // in pixels, measured when the contour is traced (0 when built point by point)
 } Contour;
 
+/*
+step I of a contour, from point I to point I +1: 0 east, 1 north, 2 west, 3 south (y up --> down).
+the opposite of step S is S ^ 2
+*/
+#define CHAIN_STEP(CNT, I) (((CNT)->chain[(I) / 4] >> ((I) % 4 * 2)) & 3)
+
+#define CHAIN_DX(S) (((S) == 0) - ((S) == 2))
+#define CHAIN_DY(S) (((S) == 3) - ((S) == 1))
+
+/*
+a connected component (blob) of a binary image,
+area is its amount of pixels, x and y its centroid
+and left, top, right, bottom its bounding box (inclusive)
+*/
+struct component {
+	size_t 	area;
+	float 	x, y;
+	size_t 	left, top, right, bottom;
+};
+
 
 // COMMON FUNCTIONS
 //----------------------------------------------------------------------------------------------------
 
 Contour* 	make_contour();
-void 		insert_point(Contour* cnt, size_t x, size_t y);
+char 		insert_point(Contour* cnt, size_t x, size_t y);
 void 		free_contour(Contour* cnt);
+void 		contour_points(Contour* cnt, struct point* points);
+
+// every run of a traced row is found, so steps_x is ignored and only steps_y skips rows
 Contour** 	find_contours(Image* img, size_t* index_size, size_t steps_x, size_t steps_y);
+Contour** 	find_contours_mask(Mask* msk, size_t* index_size, size_t steps_x, size_t steps_y);
+
+struct component* 	find_components(Image* img, size_t* amount, char eight, uint32_t** labels);
+struct component* 	find_components_mask(Mask* msk, size_t* amount, char eight, uint32_t** labels);
 
 //----------------------------------------------------------------------------------------------------
 
@@ -56,6 +101,9 @@ void 			contour_center(Contour* cnt, float* x, float* y);
 struct point* 	get_contour_extreme(Contour* cnt);
 size_t 			get_contour_area(Contour* cnt);
 void 			fit_line(Contour* cnt, float* m, float* b);
+void 			contour_moments(Contour* cnt, struct moments* m);
+float 			contour_orientation(Contour* cnt);
+void 			contour_hu_moments(Contour* cnt, double* hu);
 
 //----------------------------------------------------------------------------------------------------
 
@@ -17,6 +17,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "device.h"
+#include "record.h"
+#include "virtual.h"
+#include "jpeg.h"
+
+#include <time.h>
+#include <unistd.h>
 
 /*
 Interfacing with v4l
@@ -26,6 +32,32 @@ please refer to v4l and libv4l documentation
 // HELPERS
 //----------------------------------------------------------------------------------------------------
 
+/*
+pixel formats v4l2 devices can be opened with,
+frames keep the layout of the format (see yuv.h).
+compressed formats have no channels, their frames are decoded (see jpeg.h)
+*/
+struct pixel_format {
+	const char* 	name;
+	unsigned int 	pixelformat;
+	size_t 			channels;
+	size_t 			rows; 		// rows of the frame for every 2 rows of the picture
+};
+
+static const struct pixel_format formats[] = {
+	{"rgb24", 	V4L2_PIX_FMT_RGB24, 	3, 	2},
+	{"grey", 	V4L2_PIX_FMT_GREY, 		1, 	2},
+	{"yuyv", 	V4L2_PIX_FMT_YUYV, 		2, 	2},
+	{"nv12", 	V4L2_PIX_FMT_NV12, 		1, 	3},
+	{"mjpeg", 	V4L2_PIX_FMT_MJPEG, 	0, 	0},
+};
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 static void	xioctl(int fh, int request, void* arg) {
 	int r;
 
@@ -37,13 +69,317 @@ static void	xioctl(int fh, int request, void* arg) {
 		fprintf(stderr, "error %d, %s\n", errno, strerror(errno));
 }
 
-//----------------------------------------------------------------------------------------------------
+/*
+a leased frame is a view on a v4l2 buffer,
+the buffer is queued again once the frame is freed
+*/
+struct lease {
+	Device* 		dev;
+	unsigned int 	index;
+};
 
+static void v4l2_cleanup(Device* dev) {
+	for (int i = 0; i < dev->n_buffers; ++i) {
+		v4l2_munmap(dev->buffers[i].start, dev->buffers[i].length);
+	}
+	v4l2_close(dev->fd);
+	pthread_mutex_destroy(&dev->lease_lock);
+	pthread_mutex_destroy(&dev->frame_lock);
+	pthread_cond_destroy(&dev->frame_ready);
+	free(dev->buffers);
+	free(dev->fmt);
+	free(dev->v4l_buffer);
+	free(dev->req);
+	free(dev->tv);
+	free(dev);
+}
 
-// DEVICE FUNCTIONS
-//----------------------------------------------------------------------------------------------------
+/*
+values from one row of a driver buffer to the next
+*/
+static size_t frame_stride(Device* dev) {
+	if (dev->fmt->fmt.pix.bytesperline)
+		return dev->fmt->fmt.pix.bytesperline;
+	return dev->width * dev->format->channels;
+}
+
+static void return_lease(Image* img) {
+	struct lease* 	lease 	= img->owner;
+	Device* 		dev 	= lease->dev;
+
+	pthread_mutex_lock(&dev->lease_lock);
+	if (!dev->closed) {
+		struct v4l2_buffer buffer = {0};
+		buffer.type 	= V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buffer.memory 	= V4L2_MEMORY_MMAP;
+		buffer.index 	= lease->index;
+		xioctl(dev->fd, VIDIOC_QBUF, &buffer);
+	}
+	char last = --dev->leased == 0 && dev->closed;
+	pthread_mutex_unlock(&dev->lease_lock);
+
+	free(lease);
+	free(img);
+
+	// the device was freed before its last frame
+	if (last)
+		v4l2_cleanup(dev);
+}
+
+/*
+leases the dequeued buffer if one buffer is left for the driver,
+returns NULL if every other buffer is leased
+*/
+static Image* lease_frame(Device* dev, unsigned int index) {
+	pthread_mutex_lock(&dev->lease_lock);
+	if (dev->leased +1 >= dev->n_buffers) {
+		pthread_mutex_unlock(&dev->lease_lock);
+		return NULL;
+	}
+	dev->leased++;
+	pthread_mutex_unlock(&dev->lease_lock);
+
+	struct lease* 	lease 	= malloc(sizeof(struct lease));
+	Image* 			img 	= malloc(sizeof(Image));
+	if (lease == NULL || img == NULL) {
+		fprintf(stderr, "Cannot allocate image\n");
+		exit(EXIT_FAILURE);
+	}
+
+	lease->dev 		= dev;
+	lease->index 	= index;
+
+	img->channels 	= dev->format->channels;
+	img->width 		= dev->width;
+	img->height 	= dev->height * dev->format->rows / 2;
+	img->stride 	= frame_stride(dev);
+	img->data 		= dev->buffers[index].start;
+	img->parent 	= NULL;
+	img->refs 		= 1;
+	img->release 	= return_lease;
+	img->owner 		= lease;
+	img->timestamp 	= 0;
+	img->dequeued 	= 0;
+	img->sequence 	= 0;
+	return img;
+}
+
+static Image* v4l2_dequeue(Device* dev);
+
+/*
+an idle device times out every CAPTURE_TIMEOUT seconds, only the first timeout until a frame comes is reported
+*/
+static void report_timeout(Device* dev) {
+	if (!__atomic_exchange_n(&dev->idle, 1, __ATOMIC_RELAXED))
+		fprintf(stderr, "Timeout waiting for a frame\n");
+}
+
+/*
+waits for the driver and dequeues the oldest frame,
+returns NULL on timeout or when woken through wake
+*/
+static Image* v4l2_capture(Device* dev, int wake) {
+	uint64_t start = now_ns();
+	do {
+		FD_ZERO(&dev->fds);
+		FD_SET(dev->fd, &dev->fds);
+		if (wake >= 0)
+			FD_SET(wake, &dev->fds);
+
+		dev->tv->tv_sec	= CAPTURE_TIMEOUT;
+
+		dev->tv->tv_usec = 0;
+
+		dev->r = select((wake > dev->fd ? wake : dev->fd) + 1, &dev->fds, NULL, NULL, dev->tv);
+	} while ((dev->r == -1 && (errno == EINTR)));
+
+	__atomic_add_fetch(&dev->stats.select_time, now_ns() - start, __ATOMIC_RELAXED);
+
+	if (dev->r == -1) {
+		perror("select");
+		return NULL;
+	}
+
+	if (dev->r == 0) {
+		report_timeout(dev);
+		return NULL;
+	}
+
+	if (wake >= 0 && FD_ISSET(wake, &dev->fds))
+		return NULL;
+
+	return v4l2_dequeue(dev);
+}
+
+/*
+dequeues a frame the driver has ready, leased, copied or decoded
+*/
+static Image* v4l2_dequeue(Device* dev) {
+	free(dev->v4l_buffer);
+	dev->v4l_buffer	= calloc(1, sizeof(struct v4l2_buffer));
+
+	dev->v4l_buffer->type 	= V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	dev->v4l_buffer->memory = V4L2_MEMORY_MMAP;
+	xioctl(dev->fd, VIDIOC_DQBUF, dev->v4l_buffer);
+
+	__atomic_store_n(&dev->idle, 0, __ATOMIC_RELAXED);
+
+	// a smaller sequence number is a reset of the driver's count
+	unsigned int sequence = dev->v4l_buffer->sequence;
+	if (dev->has_sequence && sequence > dev->sequence && sequence - dev->sequence > 1) {
+		__atomic_add_fetch(&dev->stats.dropped, sequence - dev->sequence -1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&dev->stats.gaps, 1, __ATOMIC_RELAXED);
+	}
+	dev->sequence 		= sequence;
+	dev->has_sequence 	= 1;
+
+	Image* img = NULL;
+	if (dev->format->channels == 0) {
+		img = decode_jpeg(dev->buffers[dev->v4l_buffer->index].start, dev->v4l_buffer->bytesused,
+			dev->jpeg_scale, dev->jpeg_gray);
+		xioctl(dev->fd, VIDIOC_QBUF, dev->v4l_buffer);
+
+		if (img == NULL) {
+			__atomic_add_fetch(&dev->stats.corrupt, 1, __ATOMIC_RELAXED);
+			return NULL;
+		}
+	}
+	else if (__atomic_load_n(&dev->lease_mode, __ATOMIC_RELAXED))
+		img = lease_frame(dev, dev->v4l_buffer->index);
+
+	// frames are copied when not leased or when leases ran out
+	if (img == NULL) {
+		img = make_image(dev->format->channels, dev->width, dev->height * dev->format->rows / 2);
+		if (img == NULL) {
+			fprintf(stderr, "Cannot grab image from device\n");
+			return NULL;
+		}
+
+		value_t* 	data 	= dev->buffers[dev->v4l_buffer->index].start;
+		size_t 		stride 	= frame_stride(dev);
+
+		for (size_t i = 0; i < img->height; i++)
+			memcpy(IMAGE_ROW(img, i), data + i * stride, img->width * img->channels);
+		
+		xioctl(dev->fd, VIDIOC_QBUF, dev->v4l_buffer);
+	}
+
+	// the timestamp is only on the monotonic clock if the driver says so
+	struct timeval* tv = &dev->v4l_buffer->timestamp;
+	if ((dev->v4l_buffer->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+		img->timestamp = (uint64_t)tv->tv_sec * 1000000000 + (uint64_t)tv->tv_usec * 1000;
+	img->dequeued 	= now_ns();
+	img->sequence 	= sequence;
+	return img;
+}
+
+/*
+the capture thread keeps the newest frame in dev->latest,
+a frame replaced before it was read is skipped
+*/
+static void* capture_loop(void* arg) {
+	Device* dev = arg;
+
+	while (__atomic_load_n(&dev->capturing, __ATOMIC_ACQUIRE)) {
+		Image* img = v4l2_capture(dev, dev->wake[0]);
+		if (img == NULL)
+			continue;
+
+		Image* old = __atomic_exchange_n(&dev->latest, img, __ATOMIC_ACQ_REL);
+		if (old) {
+			__atomic_add_fetch(&dev->stats.skipped, 1, __ATOMIC_RELAXED);
+			free_image(old);
+		}
+
+		pthread_mutex_lock(&dev->frame_lock);
+		pthread_cond_signal(&dev->frame_ready);
+		pthread_mutex_unlock(&dev->frame_lock);
+	}
+
+	return NULL;
+}
+
+/*
+takes the newest frame of the capture thread, waits for one if it was already read
+*/
+static Image* take_latest(Device* dev) {
+	Image* img = __atomic_exchange_n(&dev->latest, NULL, __ATOMIC_ACQ_REL);
+	if (img)
+		return img;
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += CAPTURE_TIMEOUT;
+
+	pthread_mutex_lock(&dev->frame_lock);
+	while ((img = __atomic_exchange_n(&dev->latest, NULL, __ATOMIC_ACQ_REL)) == NULL) {
+		if (pthread_cond_timedwait(&dev->frame_ready, &dev->frame_lock, &deadline) == ETIMEDOUT) {
+			report_timeout(dev);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&dev->frame_lock);
+
+	return img;
+}
+
+static Image* v4l2_read_frame(Device* dev) {
+	if (dev->threaded)
+		return take_latest(dev);
+	return v4l2_capture(dev, -1);
+}
+
+/*
+leased frames keep the buffers mapped until the last one is freed
+*/
+static void v4l2_free(Device* dev) {
+	if (dev->threaded) {
+		__atomic_store_n(&dev->capturing, 0, __ATOMIC_RELEASE);
+		if (write(dev->wake[1], "", 1) < 0)
+			perror("write");
+		pthread_join(dev->capture_thread, NULL);
+		close(dev->wake[0]);
+		close(dev->wake[1]);
+
+		if (dev->latest)
+			free_image(dev->latest);
+	}
+
+	dev->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	xioctl(dev->fd, VIDIOC_STREAMOFF, &dev->type);
+
+	pthread_mutex_lock(&dev->lease_lock);
+	dev->closed = 1;
+	char leased = dev->leased > 0;
+	pthread_mutex_unlock(&dev->lease_lock);
+
+	if (!leased)
+		v4l2_cleanup(dev);
+}
+
+static const struct device_ops v4l2_ops = {
+	v4l2_read_frame,
+	v4l2_free,
+};
+
+/*
+buffers is the number of buffers asked from the driver,
+with latest set a capture thread keeps dequeuing and only the newest frame is read.
+mjpeg frames are decoded at 1/jpeg_scale of their size, only their luma if jpeg_gray is set
+*/
+static Device* make_v4l2_device(const char* name, size_t width, size_t height,
+		const struct pixel_format* format, unsigned int buffers, char latest, size_t jpeg_scale, char jpeg_gray) {
+	if (format->channels == 0) {
+		if (!jpeg_supported()) {
+			fprintf(stderr, "Kestrel was built without jpeg support\n");
+			return NULL;
+		}
+		if (jpeg_scale != 1 && jpeg_scale != 2 && jpeg_scale != 4 && jpeg_scale != 8) {
+			fprintf(stderr, "Jpeg scale must be 1, 2, 4 or 8\n");
+			return NULL;
+		}
+	}
 
-Device*	make_device(const char* name, size_t width, size_t height) {
 	Device* dev = calloc(1, sizeof(Device));
 
 	dev->fd = v4l2_open(name, O_RDWR | O_NONBLOCK, 0);
@@ -65,13 +401,13 @@ Device*	make_device(const char* name, size_t width, size_t height) {
 	dev->fmt->type						= V4L2_BUF_TYPE_VIDEO_CAPTURE; // formats
 	dev->fmt->fmt.pix.width 			= width;
 	dev->fmt->fmt.pix.height			= height;
-	dev->fmt->fmt.pix.pixelformat		= V4L2_PIX_FMT_RGB24;
+	dev->fmt->fmt.pix.pixelformat		= format->pixelformat;
 	dev->fmt->fmt.pix.field				= V4L2_FIELD_INTERLACED;
 
 	xioctl(dev->fd, VIDIOC_S_FMT, dev->fmt);
 
-	if (dev->fmt->fmt.pix.pixelformat != V4L2_PIX_FMT_RGB24) {
-		printf("Libv4l didn't accept RGB24 format\n");
+	if (dev->fmt->fmt.pix.pixelformat != format->pixelformat) {
+		printf("Libv4l didn't accept %s format\n", format->name);
 		return NULL;
 	}
 
@@ -80,7 +416,7 @@ Device*	make_device(const char* name, size_t width, size_t height) {
 			dev->fmt->fmt.pix.width, dev->fmt->fmt.pix.height);
 
 
-	dev->req->count		= 2;
+	dev->req->count		= buffers < 2 ? 2 : buffers;
 	dev->req->type		= V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	dev->req->memory	= V4L2_MEMORY_MMAP;
 
@@ -120,56 +456,314 @@ Device*	make_device(const char* name, size_t width, size_t height) {
 
 	xioctl(dev->fd, VIDIOC_STREAMON, &dev->type);	
 
+	dev->ops 	= &v4l2_ops;
+	dev->format = format;
+	dev->width 	= dev->fmt->fmt.pix.width;
+	dev->height = dev->fmt->fmt.pix.height;
+
+	// the resolution of decoded frames, rounded up like libjpeg does
+	if (format->channels == 0) {
+		dev->jpeg_scale = jpeg_scale;
+		dev->jpeg_gray 	= jpeg_gray;
+		dev->width 		= (dev->width + jpeg_scale -1) / jpeg_scale;
+		dev->height 	= (dev->height + jpeg_scale -1) / jpeg_scale;
+	}
+	pthread_mutex_init(&dev->lease_lock, NULL);
+	pthread_mutex_init(&dev->frame_lock, NULL);
+	pthread_cond_init(&dev->frame_ready, NULL);
+
+	if (latest) {
+		if (pipe(dev->wake) != 0) {
+			perror("pipe");
+			exit(EXIT_FAILURE);
+		}
+
+		dev->threaded 	= 1;
+		dev->capturing 	= 1;
+		if (pthread_create(&dev->capture_thread, NULL, capture_loop, dev) != 0) {
+			fprintf(stderr, "Cannot start capture thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
 	return dev;
 }
 
-Image* read_frame(Device* dev) {
-	do {
-		FD_ZERO(&dev->fds);
-		FD_SET(dev->fd, &dev->fds);
+/*
+returns a copy of the path of uri, the part after the scheme and before the options
+*/
+static char* uri_path(const char* uri) {
+	const char* start 	= strchr(uri, ':') +1;
+	size_t 		length 	= strcspn(start, "?");
+	char* 		path 	= malloc(length +1);
+	if (path == NULL) {
+		fprintf(stderr, "Cannot allocate device\n");
+		exit(EXIT_FAILURE);
+	}
 
-		dev->tv->tv_sec	= 2;
+	memcpy(path, start, length);
+	path[length] = 0;
+	return path;
+}
 
-		dev->tv->tv_usec = 0;
+/*
+reads option key of uri into value, def if it's not given,
+options follow the path as ?key=value&key=value.
+returns 0 if the value is not a number in [min, max]
+*/
+static char uri_option(const char* uri, const char* key, double def, double min, double max, double* value) {
+	const char* option 	= strchr(uri, '?');
+	size_t 		length 	= strlen(key);
+
+	*value = def;
+	while (option) {
+		option++;
+		if (strncmp(option, key, length) == 0 && option[length] == '=') {
+			char* end;
+			*value = strtod(option + length +1, &end);
+			if (end == option + length +1 || (*end && *end != '&') || !(*value >= min && *value <= max)) {
+				fprintf(stderr, "Invalid %s option in %s\n", key, uri);
+				return 0;
+			}
+			return 1;
+		}
+		option = strchr(option, '&');
+	}
+	return 1;
+}
 
-		dev->r = select(dev->fd + 1, &dev->fds, NULL, NULL, dev->tv);
-	} while ((dev->r == -1 && (errno = EINTR)));
+/*
+like uri_option for options that count things, the value must be a whole number
+*/
+static char uri_count(const char* uri, const char* key, size_t def, size_t min, size_t max, size_t* value) {
+	double number;
+	if (!uri_option(uri, key, def, min, max, &number))
+		return 0;
+	if (number != (size_t)number) {
+		fprintf(stderr, "Invalid %s option in %s\n", key, uri);
+		return 0;
+	}
 
-	if (dev->r == -1) {
-		perror("select");
-		return NULL;
+	*value = number;
+	return 1;
+}
+
+/*
+returns the pixel format named by the format option of uri, rgb24 if it's not given
+*/
+static const struct pixel_format* uri_format(const char* uri) {
+	const char* option = strchr(uri, '?');
+
+	while (option) {
+		option++;
+		if (strncmp(option, "format=", 7) == 0) {
+			size_t length = strcspn(option + 7, "&");
+			for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+				if (strlen(formats[i].name) == length && strncmp(option + 7, formats[i].name, length) == 0)
+					return &formats[i];
+			}
+			fprintf(stderr, "Unknown pixel format in %s\n", uri);
+			return NULL;
+		}
+		option = strchr(option, '&');
 	}
+	return &formats[0];
+}
 
+static char has_scheme(const char* uri, const char* scheme) {
+	size_t length = strlen(scheme);
+	return strncmp(uri, scheme, length) == 0 && uri[length] == ':';
+}
 
-	free(dev->v4l_buffer);
-	dev->v4l_buffer	= calloc(1, sizeof(struct v4l2_buffer));
+//----------------------------------------------------------------------------------------------------
 
-	dev->v4l_buffer->type 	= V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	dev->v4l_buffer->memory = V4L2_MEMORY_MMAP;
-	xioctl(dev->fd, VIDIOC_DQBUF, dev->v4l_buffer);
 
-	Image* img = make_image(3, dev->fmt->fmt.pix.width, dev->fmt->fmt.pix.height);
-	if (img) {
-		memcpy(img->data, dev->buffers[dev->v4l_buffer->index].start, 
-			img->channels * img->width * img->height);
-		
-		xioctl(dev->fd, VIDIOC_QBUF, dev->v4l_buffer);
-		return img;
+// DEVICE FUNCTIONS
+//----------------------------------------------------------------------------------------------------
+
+/*
+opens the device of uri, width and height are the resolution asked for
+	/dev/video0 or v4l2:/dev/video0 			v4l2 camera
+	v4l2:/dev/video0?buffers=4&latest=1 		v4l2 camera with 4 buffers read by a capture thread
+	v4l2:/dev/video0?format=yuyv 				v4l2 camera in its native format, rgb24 (default), grey, yuyv or nv12
+	v4l2:/dev/video0?format=mjpeg&scale=4&gray=1 	mjpeg camera decoded at 1/4 of its resolution, luma only
+	raw:file?realtime=1&loop=1 					recording (see record.h)
+	dir:directory?fps=30&loop=1 				pixel maps of a directory in name order
+	synthetic:?blobs=4&noise=8&fps=30&seed=1 	moving blobs (see virtual.h)
+*/
+Device* make_device(const char* uri, size_t width, size_t height) {
+	Device* dev = NULL;
+
+	// an fps over 1e9 would pace frames under a nanosecond apart
+	if (has_scheme(uri, "raw") || has_scheme(uri, "dir")) {
+		size_t realtime, loop;
+		double fps;
+		if (!uri_count(uri, "realtime", 0, 0, 1, &realtime) || !uri_count(uri, "loop", 0, 0, 1, &loop) ||
+			!uri_option(uri, "fps", 0, 0, 1e9, &fps))
+			return NULL;
+
+		char* path = uri_path(uri);
+		if (has_scheme(uri, "raw"))
+			dev = make_playback_device(path, realtime, loop);
+		else
+			dev = make_sequence_device(path, fps, loop);
+		free(path);
+	}
+	else if (has_scheme(uri, "synthetic")) {
+		size_t blobs, noise, seed;
+		double fps;
+		if (!uri_count(uri, "blobs", 4, 0, MAX_SYNTHETIC_BLOBS, &blobs) ||
+			!uri_count(uri, "noise", 0, 0, MAX_VALUE, &noise) ||
+			!uri_option(uri, "fps", 0, 0, 1e9, &fps) ||
+			!uri_count(uri, "seed", 1, 0, 1ULL << 53, &seed)) // seeds above 2^53 are not exact doubles
+			return NULL;
+
+		struct synthetic_options options = {blobs, noise, fps, seed};
+		dev = make_synthetic_device(width, height, &options);
 	}
-	else {
-		fprintf(stderr, "Cannot grab image from device\n");
+	else if (has_scheme(uri, "v4l2")) {
+		const struct pixel_format* format = uri_format(uri);
+		if (format == NULL)
+			return NULL;
+
+		size_t buffers, latest, scale, gray;
+		if (!uri_count(uri, "buffers", DEFAULT_DEVICE_BUFFERS, 1, VIDEO_MAX_FRAME, &buffers) ||
+			!uri_count(uri, "latest", 0, 0, 1, &latest) ||
+			!uri_count(uri, "scale", 1, 1, 8, &scale) ||
+			!uri_count(uri, "gray", 0, 0, 1, &gray))
+			return NULL;
+
+		char* path = uri_path(uri);
+		dev = make_v4l2_device(path, width, height, format, buffers, latest, scale, gray);
+		free(path);
+	}
+	else
+		dev = make_v4l2_device(uri, width, height, &formats[0], DEFAULT_DEVICE_BUFFERS, 0, 1, 0);
+
+	return dev;
+}
+
+
+/*
+counts and records a frame before it's returned
+*/
+static Image* deliver_frame(Device* dev, Image* img) {
+	if (img == NULL)
 		return NULL;
+
+	if (img->dequeued == 0)
+		img->dequeued = now_ns();
+
+	// intervals are measured between capture times when the driver gives them
+	uint64_t time = img->timestamp ? img->timestamp : img->dequeued;
+	if (dev->stats.delivered > 0 && time >= dev->last_time) {
+		uint64_t interval = time - dev->last_time;
+		dev->interval_sum += interval;
+		dev->intervals[dev->n_intervals++ % DEVICE_INTERVAL_WINDOW] = interval;
 	}
+	dev->last_time = time;
+	dev->stats.delivered++;
+
+	if (dev->recorder)
+		record_frame(dev->recorder, img);
+
+	return img;
+}
+
+/*
+reads a frame from any device backend, the frame is recorded if the device is recording
+*/
+Image* read_frame(Device* dev) {
+	return deliver_frame(dev, dev->ops->read_frame(dev));
+}
+
+/*
+returns the file descriptor to wait on before dequeue_frame,
+-1 if the device can't be waited on (not a v4l2 camera or read by a capture thread)
+*/
+int device_fd(Device* dev) {
+	return dev->ops == &v4l2_ops && !dev->threaded ? dev->fd : -1;
+}
+
+/*
+like read_frame but without waiting, the file descriptor of the device (see device_fd)
+must be ready to read
+*/
+Image* dequeue_frame(Device* dev) {
+	return deliver_frame(dev, v4l2_dequeue(dev));
 }
 
 void free_device(Device* dev) {
-	dev->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	xioctl(dev->fd, VIDIOC_STREAMOFF, &dev->type);
-	for (int i = 0; i < dev->n_buffers; ++i) {
-		v4l2_munmap(dev->buffers[i].start, dev->buffers[i].length);
+	if (dev->recorder)
+		free_recorder(dev->recorder);
+	dev->ops->free(dev);
+}
+
+/*
+in lease mode v4l2 frames are views on the driver buffers instead of copies,
+a buffer is given back to the driver when its frame is freed.
+frames are copied when all buffers but one are leased.
+other backends ignore the lease mode
+*/
+void device_lease_mode(Device* dev, char lease) {
+	__atomic_store_n(&dev->lease_mode, lease, __ATOMIC_RELAXED);
+}
+
+/*
+returns the pixel format of a v4l2 device (see make_device), NULL for other backends
+*/
+const char* device_format(Device* dev) {
+	return dev->format ? dev->format->name : NULL;
+}
+
+static int compare_intervals(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+/*
+counters of the frames read from dev, the 99th percentile is over the latest intervals only
+*/
+void device_stats(Device* dev, struct device_stats* stats) {
+	stats->delivered 	= dev->stats.delivered;
+	stats->skipped 		= __atomic_load_n(&dev->stats.skipped, __ATOMIC_RELAXED);
+	stats->dropped 		= __atomic_load_n(&dev->stats.dropped, __ATOMIC_RELAXED);
+	stats->gaps 		= __atomic_load_n(&dev->stats.gaps, __ATOMIC_RELAXED);
+	stats->select_time 	= __atomic_load_n(&dev->stats.select_time, __ATOMIC_RELAXED);
+	stats->corrupt 		= __atomic_load_n(&dev->stats.corrupt, __ATOMIC_RELAXED);
+
+	size_t count = dev->n_intervals < DEVICE_INTERVAL_WINDOW ? dev->n_intervals : DEVICE_INTERVAL_WINDOW;
+	if (count == 0) {
+		stats->mean_interval 	= 0;
+		stats->p99_interval 	= 0;
+		return;
 	}
-	v4l2_close(dev->fd);
-	free(dev);
+
+	uint64_t sorted[DEVICE_INTERVAL_WINDOW];
+	memcpy(sorted, dev->intervals, count * sizeof(uint64_t));
+	qsort(sorted, count, sizeof(uint64_t), compare_intervals);
+
+	stats->mean_interval 	= dev->interval_sum / dev->n_intervals;
+	stats->p99_interval 	= sorted[(count * 99 + 99) / 100 -1];
+}
+
+/*
+records every frame read from dev into file (see record.h),
+a NULL file stops the recording.
+returns 0 if the recording cannot be started, or when stopping if it was not written completely
+*/
+char record_device(Device* dev, const char* file) {
+	char ok = 1;
+	if (dev->recorder) {
+		ok = free_recorder(dev->recorder);
+		dev->recorder = NULL;
+	}
+
+	if (file)
+		dev->recorder = make_recorder(file);
+
+	return file ? dev->recorder != NULL : ok;
 }
 
 //----------------------------------------------------------------------------------------------------
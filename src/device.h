@@ -27,13 +27,59 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <sys/mman.h>
 #include <linux/videodev2.h>
 #include <libv4l2.h>
+#include <pthread.h>
 
 typedef struct {
 	void*	start;
 	size_t	length;
 } Buffer;
 
-typedef struct {
+struct Device;
+struct Recorder;
+struct pixel_format;
+
+/*
+frame counters of a device, times are in ns
+	delivered 		frames returned by read_frame
+	skipped 		frames captured by the capture thread but replaced by a newer frame before being read
+	dropped 		frames the driver dropped, found by gaps in the sequence numbers.
+					a sequence number going back is a restart of the driver's count, not a drop
+	gaps 			gaps in the sequence numbers
+	mean_interval 	mean time between the frames delivered
+	p99_interval 	99th percentile of the time between the latest frames delivered
+	select_time 	time spent waiting for the driver in select
+	corrupt 		compressed frames that could not be decoded
+*/
+struct device_stats {
+	size_t 		delivered;
+	size_t 		skipped;
+	size_t 		dropped;
+	size_t 		gaps;
+	uint64_t 	mean_interval;
+	uint64_t 	p99_interval;
+	uint64_t 	select_time;
+	size_t 		corrupt;
+};
+
+/*
+functions of a device backend
+read_frame returns NULL when no frame can be read
+*/
+struct device_ops {
+	struct Image* 	(*read_frame)(struct Device* dev);
+	void 			(*free)(struct Device* dev);
+};
+
+/*
+the v4l2 fields are only used by v4l2 devices,
+other backends keep their state in backend
+*/
+typedef struct Device {
+	const struct device_ops* 		ops;
+	size_t 							width, height; // resolution of the frames
+	void* 							backend;
+	struct Recorder* 				recorder; // every frame read is recorded when set
+
 	struct v4l2_format*				fmt;
 	struct v4l2_buffer*				v4l_buffer;
 	struct v4l2_requestbuffers*		req;
@@ -45,6 +91,35 @@ typedef struct {
 	char							dev_name;
 	char							out_name[256];
 	Buffer*							buffers;
+	const struct pixel_format* 		format; // layout of the frames, see make_device
+	size_t 							jpeg_scale;
+	char 							jpeg_gray;
+
+	// frame leases, see device_lease_mode
+	char 							lease_mode;
+	char 							closed; 	// freed while frames were still leased
+	unsigned int 					leased;
+	pthread_mutex_t 				lease_lock;
+
+	// capture thread, see make_device
+	char 							threaded;
+	char 							capturing;
+	pthread_t 						capture_thread;
+	int 							wake[2]; // pipe waking the capture thread when stopping
+	struct Image* 					latest; // newest frame not read yet, exchanged atomically
+	pthread_mutex_t 				frame_lock;
+	pthread_cond_t 					frame_ready;
+
+	struct device_stats 			stats;
+	char 							has_sequence;
+	unsigned int 					sequence; // sequence number of the last frame
+	char 							idle; // a timeout was reported and no frame came since, accessed atomically
+
+	// intervals between the frames delivered
+	uint64_t 						last_time;
+	uint64_t 						interval_sum;
+	size_t 							n_intervals;
+	uint64_t 						intervals[DEVICE_INTERVAL_WINDOW]; // the latest intervals
 } Device;
 
 
@@ -54,6 +129,12 @@ typedef struct {
 Device*		make_device(const char* name, size_t width, size_t height);
 Image*		read_frame(Device* dev);
 void		free_device(Device* dev);
+char 		record_device(Device* dev, const char* file);
+void 		device_lease_mode(Device* dev, char lease);
+void 		device_stats(Device* dev, struct device_stats* stats);
+const char* device_format(Device* dev);
+int 		device_fd(Device* dev);
+Image* 		dequeue_frame(Device* dev);
 
 //----------------------------------------------------------------------------------------------------
 
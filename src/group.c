@@ -0,0 +1,209 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "group.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+// HELPERS
+//----------------------------------------------------------------------------------------------------
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t frame_time(Image* img) {
+	return img->timestamp ? img->timestamp : img->dequeued;
+}
+
+static void discard(CaptureGroup* grp, size_t i) {
+	free_image(grp->pending[i]);
+	grp->pending[i] = NULL;
+	grp->discarded++;
+}
+
+/*
+matches the pending frames, returns 1 and moves them to frames if every device has
+a frame within the window. the oldest frame can never be matched once the newest
+is more than the window after it, since later frames are only newer
+*/
+static char match_pending(CaptureGroup* grp, Image** frames) {
+	while (1) {
+		size_t oldest = 0, newest = 0;
+		for (size_t i = 0; i < grp->count; i++) {
+			if (grp->pending[i] == NULL)
+				return 0;
+			if (frame_time(grp->pending[i]) < frame_time(grp->pending[oldest]))
+				oldest = i;
+			if (frame_time(grp->pending[i]) > frame_time(grp->pending[newest]))
+				newest = i;
+		}
+
+		if (frame_time(grp->pending[newest]) - frame_time(grp->pending[oldest]) <= grp->window)
+			break;
+		discard(grp, oldest);
+	}
+
+	uint64_t first = frame_time(grp->pending[0]);
+	for (size_t i = 0; i < grp->count; i++) {
+		int64_t skew = (int64_t)(frame_time(grp->pending[i]) - first);
+
+		grp->skew_sum[i] += skew;
+		if ((uint64_t)llabs(skew) > grp->skew_max[i])
+			grp->skew_max[i] = llabs(skew);
+
+		frames[i] 			= grp->pending[i];
+		grp->pending[i] 	= NULL;
+	}
+	grp->sets++;
+	return 1;
+}
+
+//----------------------------------------------------------------------------------------------------
+
+// GROUP FUNCTIONS
+//----------------------------------------------------------------------------------------------------
+
+/*
+window is the largest difference in ns between the frames of a set,
+every device must be a v4l2 camera without a capture thread (see device_fd)
+*/
+CaptureGroup* make_group(Device** devices, size_t count, uint64_t window) {
+	if (count == 0) {
+		fprintf(stderr, "Capture group needs at least one device\n");
+		return NULL;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (device_fd(devices[i]) < 0) {
+			fprintf(stderr, "Only v4l2 cameras without a capture thread can be grouped\n");
+			return NULL;
+		}
+	}
+
+	int epoll_fd = epoll_create1(0);
+	if (epoll_fd < 0) {
+		perror("epoll_create1");
+		return NULL;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		struct epoll_event event = {0};
+		event.events 	= EPOLLIN;
+		event.data.u64 	= i;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, device_fd(devices[i]), &event) != 0) {
+			perror("epoll_ctl");
+			close(epoll_fd);
+			return NULL;
+		}
+	}
+
+	CaptureGroup* grp = calloc(1, sizeof(CaptureGroup));
+	if (grp == NULL) {
+		fprintf(stderr, "Cannot allocate capture group\n");
+		exit(EXIT_FAILURE);
+	}
+
+	grp->devices 	= malloc(count * sizeof(Device*));
+	grp->pending 	= calloc(count, sizeof(Image*));
+	grp->skew_sum 	= calloc(count, sizeof(int64_t));
+	grp->skew_max 	= calloc(count, sizeof(uint64_t));
+	if (!(grp->devices && grp->pending && grp->skew_sum && grp->skew_max)) {
+		fprintf(stderr, "Cannot allocate capture group\n");
+		exit(EXIT_FAILURE);
+	}
+
+	memcpy(grp->devices, devices, count * sizeof(Device*));
+	grp->count 		= count;
+	grp->window 	= window;
+	grp->epoll_fd 	= epoll_fd;
+	return grp;
+}
+
+/*
+waits for a set of frames and puts them in frames in the order of the devices,
+returns 0 if no set was matched before the timeout (CAPTURE_TIMEOUT)
+*/
+char read_group(CaptureGroup* grp, Image** frames) {
+	uint64_t 			deadline = now_ns() + (uint64_t)CAPTURE_TIMEOUT * 1000000000;
+	struct epoll_event 	events[grp->count];
+
+	while (!match_pending(grp, frames)) {
+		uint64_t now = now_ns();
+		if (now >= deadline) {
+			fprintf(stderr, "Timeout waiting for a set of frames\n");
+			return 0;
+		}
+
+		int ready = epoll_wait(grp->epoll_fd, events, grp->count, (deadline - now) / 1000000 +1);
+		if (ready < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			return 0;
+		}
+
+		// a newer frame of a device is a better match than the older one
+		for (int k = 0; k < ready; k++) {
+			size_t 	i 	= events[k].data.u64;
+			Image* 	img = dequeue_frame(grp->devices[i]);
+			if (img == NULL)
+				continue;
+
+			if (grp->pending[i])
+				discard(grp, i);
+			grp->pending[i] = img;
+		}
+	}
+
+	return 1;
+}
+
+void group_stats(CaptureGroup* grp, struct group_stats* stats) {
+	stats->sets 		= grp->sets;
+	stats->discarded 	= grp->discarded;
+}
+
+/*
+mean and largest difference in ns between the frames of device i and the first device
+*/
+void group_skew(CaptureGroup* grp, size_t i, int64_t* mean, uint64_t* max) {
+	*mean 	= grp->sets ? grp->skew_sum[i] / (int64_t)grp->sets : 0;
+	*max 	= grp->skew_max[i];
+}
+
+/*
+the devices are not freed
+*/
+void free_group(CaptureGroup* grp) {
+	for (size_t i = 0; i < grp->count; i++) {
+		if (grp->pending[i])
+			free_image(grp->pending[i]);
+	}
+
+	close(grp->epoll_fd);
+	free(grp->devices);
+	free(grp->pending);
+	free(grp->skew_sum);
+	free(grp->skew_max);
+	free(grp);
+}
+
+//----------------------------------------------------------------------------------------------------
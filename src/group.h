@@ -0,0 +1,66 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GROUP_H
+#define GROUP_H
+
+#include "common.h"
+#include "image.h"
+#include "device.h"
+
+/*
+a capture group waits on several v4l2 cameras at once
+and returns sets of frames taken within the sync window of each other.
+
+frames are matched on their driver timestamps (their dequeue time if the driver gives none),
+a frame that can't be matched anymore is discarded.
+the devices stay owned by the caller and must not be read from while in a group
+*/
+typedef struct {
+	Device** 	devices;
+	size_t 		count;
+	uint64_t 	window; 	// ns
+	int 		epoll_fd;
+	Image** 	pending; 	// latest unmatched frame of every device
+	size_t 		sets;
+	size_t 		discarded;
+	int64_t* 	skew_sum; 	// time of every device minus time of the first device, over the sets
+	uint64_t* 	skew_max;
+} CaptureGroup;
+
+/*
+sets 		sets of frames returned
+discarded 	frames without a match
+*/
+struct group_stats {
+	size_t 	sets;
+	size_t 	discarded;
+};
+
+// GROUP FUNCTIONS
+//----------------------------------------------------------------------------------------------------
+
+CaptureGroup* 	make_group(Device** devices, size_t count, uint64_t window);
+char 			read_group(CaptureGroup* grp, Image** frames);
+void 			group_stats(CaptureGroup* grp, struct group_stats* stats);
+void 			group_skew(CaptureGroup* grp, size_t i, int64_t* mean, uint64_t* max);
+void 			free_group(CaptureGroup* grp);
+
+//----------------------------------------------------------------------------------------------------
+
+#endif
@@ -17,10 +17,19 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "image.h"
+#include "kernel.h"
+#include "pool.h"
+#include "workers.h"
+
+#include <ctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define MIN(MIN_A,MIN_B) (((MIN_A)<(MIN_B))?(MIN_A):(MIN_B))
 #define MAX(MAX_A,MAX_B) (((MAX_A)>(MAX_B))?(MAX_A):(MAX_B))
 
+#define ROW_BLOCK 256 // pixels a band function buffers at once on its stack
+
 // HELPERS
 //----------------------------------------------------------------------------------------------------
 
@@ -41,27 +50,215 @@ static int divide(value_t current, float x) {
 	return (int)((float)current / x);
 }
 
-static Image* arth_operation(Image* img, int (*fn)(value_t value, float x), float x) {
-	Image* result = make_image(img->channels, img->width, img->height);
+/*
+same as make_image but the data is not zeroed,
+used for results that are completely overwritten
+*/
+static Image* alloc_image(size_t channels, size_t width, size_t height) {
+	return pool_acquire(channels, width, height);
+}
+
+/*
+returns 1 if the regions of a and b share any value,
+images are compared through the image owning their data
+*/
+static char overlaps(Image* a, Image* b) {
+	Image* owner_a = a->parent ? a->parent : a;
+	Image* owner_b = b->parent ? b->parent : b;
+	if (a == b)
+		return 1;
+	if (owner_a != owner_b || owner_a->stride == 0)
+		return 0;
+
+	size_t offset_a = a->data - owner_a->data;
+	size_t offset_b = b->data - owner_b->data;
+	size_t stride 	= owner_a->stride;
+
+	// regions in values of the owner, x in [x0, x0 + width * channels) and y in [y0, y0 + height)
+	size_t ax = offset_a % stride, ay = offset_a / stride;
+	size_t bx = offset_b % stride, by = offset_b / stride;
+
+	return ax < bx + b->width * b->channels && bx < ax + a->width * a->channels &&
+		ay < by + b->height && by < ay + a->height;
+}
+
+/*
+returns the destination of an image function
+a new image is made if dst is NULL, otherwise dst is checked once against the
+expected shape and must not overlap the sources (src2 can be NULL)
+*/
+Image* prepare_dst(Image* dst, Image* src1, Image* src2, size_t channels, size_t width, size_t height) {
+	if (dst == NULL)
+		return alloc_image(channels, width, height);
+
+	if (overlaps(dst, src1) || (src2 && overlaps(dst, src2))) {
+		fprintf(stderr, "Destination image must not overlap a source image\n");
+		return NULL;
+	}
+
+	if (dst->channels != channels || dst->width != width || dst->height != height) {
+		fprintf(stderr, "Destination image shape mismatch, expected %ldx%ldx%ld\n", channels, width, height);
+		return NULL;
+	}
+
+	return dst;
+}
+
+/*
+arguments of an image function, shared by the bands running it
+*/
+struct job {
+	Image* 			img;
+	Image* 			img2;
+	Image* 			result;
+	value_t* 		lower;
+	value_t* 		upper;
+	value_t 		on;
+	value_t 		off;
+	size_t 			channel;
+	enum hsv_scale 	scale;
+	enum sobel_norm norm;
+	const value_t* 	lut;
+	value_t 		(*logic_fn)(value_t a, value_t b);
+};
+
+/*
+copies the pixels [x, x + n) of row y of img into block,
+pixels outside of img are zeroed
+*/
+static void pad_block(Image* img, size_t y, size_t x, value_t* block, size_t n) {
+	size_t inside = y < img->height && x < img->width ? MIN(n, img->width - x) : 0;
+	if (inside)
+		memcpy(block, IMAGE_ROW(img, y) + x * img->channels, inside * img->channels);
+	memset(block + inside * img->channels, 0, (n - inside) * img->channels);
+}
+
+/*
+band functions run the rows [y0, y1) of an image function (see workers.c)
+*/
+static void split_band(void* ctx, size_t y0, size_t y1) {
+	struct job* job = ctx;
+	for (size_t i = y0; i < y1; i++)
+		kernel_split_channel(IMAGE_ROW(job->img, i), IMAGE_ROW(job->result, i), job->img->width,
+			job->img->channels, job->channel);
+}
 
-	for (int i = 0; i < img->height; i++) {
-		for (int j = 0; j < img->width; j++) {
-			for (int c = 0; c < img->channels; c++){
-				value_t v = get_at(img, c, j, i, 0);
-				int nv = (*fn)(v, x);
+static void in_range_band(void* ctx, size_t y0, size_t y1) {
+	struct job* job = ctx;
+	for (size_t i = y0; i < y1; i++)
+		kernel_in_range(IMAGE_ROW(job->img, i), IMAGE_ROW(job->result, i), job->img->width,
+			job->img->channels, job->lower, job->upper, job->on, job->off);
+}
 
-				if (nv < 0) 
-					nv = 0;
+static void hsv_band(void* ctx, size_t y0, size_t y1) {
+	struct job* job = ctx;
+	for (size_t i = y0; i < y1; i++)
+		kernel_rgb_to_hsv(IMAGE_ROW(job->img, i), IMAGE_ROW(job->result, i), job->img->width, job->scale);
+}
 
-				else if (nv > MAX_VALUE) 
-					nv = MAX_VALUE;
+static void hsv_in_range_band(void* ctx, size_t y0, size_t y1) {
+	struct job* job = ctx;
+	for (size_t i = y0; i < y1; i++)
+		kernel_hsv_in_range(IMAGE_ROW(job->img, i), IMAGE_ROW(job->result, i), job->img->width, job->scale,
+			job->lower, job->upper, job->on, job->off);
+}
+
+static void grayscale_band(void* ctx, size_t y0, size_t y1) {
+	struct job* job = ctx;
+	for (size_t i = y0; i < y1; i++)
+		kernel_grayscale(IMAGE_ROW(job->img, i), IMAGE_ROW(job->result, i), job->img->width, job->img->channels);
+}
 
-				set_at(result, c, j, i, (value_t)nv);
+/*
+the rows above and below a band are read from the source image,
+so bands need no extra synchronization.
+rows are filtered in blocks with the columns on both sides of a block
+*/
+static void sobel_band(void* ctx, size_t y0, size_t y1) {
+	struct job* job 	= ctx;
+	Image* 		img 	= job->img;
+	size_t 		width 	= img->width;
+	size_t 		height 	= img->height;
+
+	// one extra value on each side for the neighbours or the repeated border
+	int16_t smooth[ROW_BLOCK +2];
+	int16_t diff[ROW_BLOCK +2];
+
+	for (size_t i = y0; i < y1; i++) {
+		value_t* up 	= IMAGE_ROW(img, i > 0 ? i -1 : 0);
+		value_t* mid 	= IMAGE_ROW(img, i);
+		value_t* down 	= IMAGE_ROW(img, i +1 < height ? i +1 : i);
+
+		for (size_t j = 0; j < width; j += ROW_BLOCK) {
+			size_t n 	= MIN(ROW_BLOCK, width - j);
+			size_t lo 	= j > 0 ? j -1 : j;
+			size_t hi 	= j + n < width ? j + n +1 : j + n;
+			size_t at 	= 1 - (j - lo); // where column lo goes in the block
+
+			kernel_sobel_vertical(up + lo, mid + lo, down + lo, smooth + at, diff + at, hi - lo);
+
+			if (lo == j) {
+				smooth[0] 	= smooth[1];
+				diff[0] 	= diff[1];
+			}
+			if (hi == j + n) {
+				smooth[n +1] 	= smooth[n];
+				diff[n +1] 		= diff[n];
 			}
+
+			kernel_sobel_horizontal(smooth +1, diff +1, IMAGE_ROW(job->result, i) + j * job->result->channels, n,
+				job->norm);
 		}
 	}
+}
 
-	return result;
+static void invert_band(void* ctx, size_t y0, size_t y1) {
+	struct job* job = ctx;
+	for (size_t i = y0; i < y1; i++)
+		kernel_invert(IMAGE_ROW(job->img, i), IMAGE_ROW(job->result, i), job->img->width * job->img->channels);
+}
+
+static void lut_band(void* ctx, size_t y0, size_t y1) {
+	struct job* job = ctx;
+	for (size_t i = y0; i < y1; i++)
+		kernel_lut(IMAGE_ROW(job->img, i), IMAGE_ROW(job->result, i), job->img->width * job->img->channels,
+			job->lut);
+}
+
+static void logic_band(void* ctx, size_t y0, size_t y1) {
+	struct job* job = ctx;
+	for (size_t i = y0; i < y1; i++)
+		kernel_logic(IMAGE_ROW(job->img, i), IMAGE_ROW(job->img2, i), IMAGE_ROW(job->result, i),
+			job->result->width, job->logic_fn);
+}
+
+static void logic_pad_band(void* ctx, size_t y0, size_t y1) {
+	struct job* job 	= ctx;
+	size_t 		width 	= job->result->width;
+	value_t 	block1[ROW_BLOCK];
+	value_t 	block2[ROW_BLOCK];
+
+	for (size_t i = y0; i < y1; i++) {
+		for (size_t j = 0; j < width; j += ROW_BLOCK) {
+			size_t n = MIN(ROW_BLOCK, width - j);
+			pad_block(job->img, i, j, block1, n);
+			pad_block(job->img2, i, j, block2, n);
+			kernel_logic(block1, block2, IMAGE_ROW(job->result, i) + j, n, job->logic_fn);
+		}
+	}
+}
+
+/*
+the result of fn only depends on the value, so it is computed once
+for every possible value and applied as a lookup table
+*/
+static Image* arth_operation(Image* img, int (*fn)(value_t value, float x), float x, Image* dst) {
+	value_t lut[MAX_VALUE +1];
+	for (int v = 0; v <= MAX_VALUE; v++) {
+		int nv = (*fn)(v, x);
+		lut[v] = nv < 0 ? 0 : (nv > MAX_VALUE ? MAX_VALUE : nv);
+	}
+	return apply_lut_into(img, lut, dst);
 }
 
 static value_t and(value_t a, value_t b) {
@@ -76,16 +273,24 @@ static value_t xor(value_t a, value_t b) {
 	return (!a && b) || (a && !b);
 }
 
-static Image* logic_operation(Image* img1, Image* img2, value_t (*fn)(value_t a, value_t b)) {
+/*
+images of different sizes are padded with zeros to the larger size
+*/
+static Image* logic_operation(Image* img1, Image* img2, value_t (*fn)(value_t a, value_t b), Image* dst) {
 	if (img1->channels == 1 && img2->channels == 1) {
 		size_t width 	= MAX(img1->width, img2->width);	
 		size_t height 	= MAX(img1->height, img2->height);	
-		Image* result 	= make_image(1, width, height);
+		Image* result 	= prepare_dst(dst, img1, img2, 1, width, height);
+
+		if (result == NULL)
+			return NULL;
+
+		struct job job = {.img = img1, .img2 = img2, .result = result, .logic_fn = fn};
+		if (img1->width == img2->width && img1->height == img2->height)
+			workers_run(logic_band, &job, width, height);
+		else
+			workers_run(logic_pad_band, &job, width, height);
 
-		for (int i = 0; i < height; i++) {
-			for (int j = 0; j < width; j++)
-				set_at(result, 0, i, j, (*fn)(get_at(img1, 0, j, i, 0), get_at(img2, 0, j, i, 0)));
-		}
 		return result;
 	}
 	else {
@@ -94,48 +299,72 @@ static Image* logic_operation(Image* img1, Image* img2, value_t (*fn)(value_t a,
 	}
 }
 
-
-static double sobel_helper(Image* img, size_t x, size_t y) {
-	int Gx[3][3] = {{-1, 0, 1},
-					{-2, 0, 2},
-					{-1, 0, 1}} ;
-
-	int Gy[3][3] = {{-1, -2, -1},
-					{0, 0, 0},
-					{1, 2, 1}};
-	double mag_x = 0, mag_y = 0;
-	for (int i = 0; i < 3; i++) {
-		for (int j = 0; j < 3; j++) {
-			mag_x += Gx[i][j] * get_at(img, 0, x - j, y - i, 0);
-			mag_y += Gy[i][j] * get_at(img, 0, x - j, y - i, 0);
-		}
-	}
-	return pow(mag_x * mag_x + mag_y * mag_y, 0.5);
-}
 //----------------------------------------------------------------------------------------------------
 
 // COMMON FUNCTIONS
 //----------------------------------------------------------------------------------------------------
 
+/*
+images are taken from and given back to the pool (see pool.c)
+*/
 Image* make_image(size_t channels, size_t width, size_t height) {
-	value_t* data = calloc(width * height * channels, sizeof(value_t));
-	if (data) {
-		Image* img 		= malloc(sizeof(Image));
-		img->channels 	= channels;
-		img->width 		= width;
-		img->height 	= height;
-		img->data 		= data;
-		return img;
+	Image* img = pool_acquire(channels, width, height);
+	memset(img->data, 0, channels * width * height * sizeof(value_t));
+	return img;
+}
+
+/*
+drops a reference to the image,
+the data is given back once the image and all its views are freed
+*/
+void free_image(Image* img) {
+	if (__atomic_sub_fetch(&img->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+
+	if (img->parent) {
+		Image* parent = img->parent;
+		free(img);
+		free_image(parent);
 	}
-	else {
+	else if (img->release)
+		img->release(img);
+	else
+		pool_release(img);
+}
+
+/*
+returns a view on the width x height region of img starting at (x, y),
+the view shares the data of img so writing to one changes the other
+*/
+Image* make_view(Image* img, size_t x, size_t y, size_t width, size_t height) {
+	if (x > img->width || y > img->height || width > img->width - x || height > img->height - y) {
+		fprintf(stderr, "View out of image bounds\n");
+		return NULL;
+	}
+
+	Image* view = malloc(sizeof(Image));
+	if (view == NULL) {
 		fprintf(stderr, "Cannot allocate image\n");
 		exit(EXIT_FAILURE);
 	}
-}
 
-void free_image(Image* img) {
-	free(img->data);
-	free(img);
+	// views of views refer to the image owning the data
+	Image* owner = img->parent ? img->parent : img;
+	__atomic_add_fetch(&owner->refs, 1, __ATOMIC_RELAXED);
+
+	view->channels 	= img->channels;
+	view->width 	= width;
+	view->height 	= height;
+	view->stride 	= img->stride;
+	view->data 		= IMAGE_ROW(img, y) + x * img->channels;
+	view->parent 	= owner;
+	view->refs 		= 1;
+	view->release 	= NULL;
+	view->owner 	= NULL;
+	view->timestamp = img->timestamp;
+	view->dequeued 	= img->dequeued;
+	view->sequence 	= img->sequence;
+	return view;
 }
 
 /*
@@ -145,38 +374,43 @@ get and set don't return error if given invalid index
 that is because some algorithms can go out of range
 
 get_at will just return a default value if out of range
+
+both are meant for scripting and single pixel access,
+the image functions below walk rows through the kernels instead
 */
 value_t get_at(Image* img, size_t chnl, size_t x, size_t y, value_t def_value) {
-	size_t index = chnl + img->channels * (x + y * img->width);
-	if (index >= 0 && index < img->width * img->height * img->channels &&
-			x < img->width && x >= 0 &&
-			y < img->height && y >= 0 &&
-			chnl < img->channels && chnl >= 0)
-
-		return img->data[index];
-
+	if (x < img->width && y < img->height && chnl < img->channels)
+		return IMAGE_ROW(img, y)[x * img->channels + chnl];
 	else 
 		return def_value;
 
 }
 
 void set_at(Image* img, size_t chnl, size_t x, size_t y, value_t value) {
-	size_t index = chnl + img->channels * (x + y * img->width);
-	if (index >= 0 && index < img->width * img->height * img->channels &&
-			x < img->width && x >= 0 &&
-			y < img->height && y >= 0 &&
-			chnl < img->channels && chnl >= 0)
-
-		img->data[index] = value;
+	if (x < img->width && y < img->height && chnl < img->channels)
+		IMAGE_ROW(img, y)[x * img->channels + chnl] = value;
 }
 
+/*
+every image function has an _into version writing into dst,
+dst must have the shape of the result and must not be a source image.
+if dst is NULL a new image is made.
+the _into functions return the result or NULL on error
+*/
+
 Image* split_channel(Image* img, size_t c) {
+	return split_channel_into(img, c, NULL);
+}
+
+Image* split_channel_into(Image* img, size_t c, Image* dst) {
 	if (c < img->channels) {
-		Image* result = make_image(1, img->width, img->height);
-		for (int i = 0; i < img->height; i++) {
-			for (int j = 0; j < img->width; j++) 
-				set_at(result, 0, j, i, get_at(img, c, j, i, 0));
-		}
+		Image* result = prepare_dst(dst, img, NULL, 1, img->width, img->height);
+		if (result == NULL)
+			return NULL;
+
+		struct job job = {.img = img, .result = result, .channel = c};
+		workers_run(split_band, &job, img->width, img->height);
+
 		return result;
 	}
 	else {
@@ -192,58 +426,64 @@ in range doesn't check if lower and upper's array lengths are valid
 it assumes that lower and upper's length are both equal to the number of channels
 */
 Image* in_range(Image* img, value_t* lower, value_t* upper, value_t on, value_t off) {
-	Image* result = make_image(1, img->width, img->height);
-	size_t chnls = img->channels;
-	value_t current[chnls];
-	for (int i = 0; i < img->height; i++) {
-		for (int j = 0; j < img->width; j++) {
-			for (int c = 0; c < chnls; c++) 
-				current[c] = get_at(img, c, j, i, 0);
-
-			value_t is_on = on;
-			for (int c = 0; c < chnls; c++) 
-				if (current[c] < lower[c] || current[c] > upper[c])
-					is_on = off;
-
-			set_at(result, 0, j, i, is_on);
-			
-		}
-	}
+	return in_range_into(img, lower, upper, on, off, NULL);
+}
+
+Image* in_range_into(Image* img, value_t* lower, value_t* upper, value_t on, value_t off, Image* dst) {
+	Image* result = prepare_dst(dst, img, NULL, 1, img->width, img->height);
+	if (result == NULL)
+		return NULL;
+
+	struct job job = {.img = img, .result = result, .lower = lower, .upper = upper, .on = on, .off = off};
+	workers_run(in_range_band, &job, img->width, img->height);
+
 	return result;
 }
 
 /*
 RGB to HSV conversion
+see enum hsv_scale for the ranges of each scale
 */
-Image* rgb_to_hsv(Image* img) {
+Image* rgb_to_hsv(Image* img, enum hsv_scale scale) {
+	return rgb_to_hsv_into(img, scale, NULL);
+}
+
+Image* rgb_to_hsv_into(Image* img, enum hsv_scale scale, Image* dst) {
 	if (img->channels == 3) {
-		Image* result = make_image(3, img->width, img->height);
-		for (int i = 0; i < img->height; i++) {
-			for (int j = 0; j < img->width; j++) {
-				float r 	= (float)get_at(img, 0, j, i, 0)/255;
-				float g 	= (float)get_at(img, 1, j, i, 0)/255;
-				float b		= (float)get_at(img, 2, j, i, 0)/255;
-				float max 	= MAX(MAX(r, g), b);
-				float min 	= MIN(MIN(r, g), b);
-				float df	= max - min;
-				if (df == 0) 
-					set_at(result, 0, j, i, 0);
-				else if (max == r)
-					set_at(result, 0, j, i, (value_t)((int)(60 * ((g-b)/df) + 360) % 360));
-				else if (max == g)
-					set_at(result, 0, j, i, (value_t)((int)(60 * ((b-r)/df) + 120) % 360));
-				else if (max == b)
-					set_at(result, 0, j, i, (value_t)((int)(60 * ((r-g)/df) + 240) % 360));
-
-				if (max == 0)
-					set_at(result, 1, j, i, 0);
-				else
-					set_at(result, 1, j, i, (value_t)((df/max)*100));
-					
-				set_at(result, 2, j, i, (value_t)(max*100));
-			}
-		}
-		
+		Image* result = prepare_dst(dst, img, NULL, 3, img->width, img->height);
+		if (result == NULL)
+			return NULL;
+
+		struct job job = {.img = img, .result = result, .scale = scale};
+		workers_run(hsv_band, &job, img->width, img->height);
+
+		return result;
+	}
+	else {
+		fprintf(stderr, "Must have only R G B channels\n");
+		return NULL;
+	}
+}
+
+/*
+same as in_range(rgb_to_hsv(img), ...) without making the hsv image
+lower and upper are the hsv bounds
+*/
+Image* hsv_in_range(Image* img, enum hsv_scale scale, value_t* lower, value_t* upper, value_t on, value_t off) {
+	return hsv_in_range_into(img, scale, lower, upper, on, off, NULL);
+}
+
+Image* hsv_in_range_into(Image* img, enum hsv_scale scale, value_t* lower, value_t* upper,
+		value_t on, value_t off, Image* dst) {
+	if (img->channels == 3) {
+		Image* result = prepare_dst(dst, img, NULL, 1, img->width, img->height);
+		if (result == NULL)
+			return NULL;
+
+		struct job job = {.img = img, .result = result, .scale = scale,
+			.lower = lower, .upper = upper, .on = on, .off = off};
+		workers_run(hsv_in_range_band, &job, img->width, img->height);
+
 		return result;
 	}
 	else {
@@ -257,42 +497,44 @@ any image type to grayscale conversion
 average of all channels
 */
 Image* grayscale(Image* img) {
-	Image* result 		= make_image(1, img->width, img->height);
-	size_t chnls_amount = img->channels;
-
-	for (int i = 0; i < img->height; i++) {
-		for (int j = 0; j < img->width; j++) {
-			int sum = 0;
-			for (int c = 0; c < chnls_amount; c++)
-				sum += get_at(img, c, j, i, 0);
-				
-			set_at(result, 0, j, i, sum/chnls_amount);
-		}
-	}
-	
+	return grayscale_into(img, NULL);
+}
+
+Image* grayscale_into(Image* img, Image* dst) {
+	Image* result = prepare_dst(dst, img, NULL, 1, img->width, img->height);
+	if (result == NULL)
+		return NULL;
+
+	struct job job = {.img = img, .result = result};
+	workers_run(grayscale_band, &job, img->width, img->height);
+
 	return result;
 }
 
 /*
 grayscale to sobel
+the kernel is centered on each pixel and the border pixels are repeated,
+so every pixel of the result is set
+
+the 3x3 kernels are split into a vertical pass over three rows
+and a horizontal pass over two int16 block buffers on the stack (see sobel_band)
 */
-Image* sobel(Image* img) {
+Image* sobel(Image* img, enum sobel_norm norm) {
+	return sobel_into(img, norm, NULL);
+}
+
+Image* sobel_into(Image* img, enum sobel_norm norm, Image* dst) {
 
 	if (img->channels == 1) {
+		size_t width 	= img->width;
+		size_t height 	= img->height;
+		Image* result 	= prepare_dst(dst, img, NULL, norm == SOBEL_RAW ? 2 : 1, width, height);
 
-		Image* result = make_image(1, img->width, img->height);
-		for (int i = 2; i < img->height -2; i++) {
-			for (int j = 2; j < img->width -2; j++) {
-				int 	sv 	= (int)sobel_helper(img, j, i);
-				value_t v 	= 0;
-				if (sv > MAX_VALUE)
-					v = MAX_VALUE;
-				else
-					v = sv;
-
-				set_at(result, 0, j, i, v);
-			}
-		}
+		if (result == NULL || width == 0 || height == 0)
+			return result;
+
+		struct job job = {.img = img, .result = result, .norm = norm};
+		workers_run(sobel_band, &job, width, height);
 
 		return result;
 	}
@@ -306,15 +548,36 @@ Image* sobel(Image* img) {
 returns the inverted image
 */
 Image* invert_image(Image* img) {
-	Image* result = make_image(img->channels, img->width, img->height);
+	return invert_image_into(img, NULL);
+}
+
+Image* invert_image_into(Image* img, Image* dst) {
+	Image* result = prepare_dst(dst, img, NULL, img->channels, img->width, img->height);
+	if (result == NULL)
+		return NULL;
+
+	struct job job = {.img = img, .result = result};
+	workers_run(invert_band, &job, img->width, img->height);
+
+	return result;
+}
+
+/*
+maps every value v of the image to lut[v],
+lut must have MAX_VALUE +1 entries
+*/
+Image* apply_lut(Image* img, const value_t* lut) {
+	return apply_lut_into(img, lut, NULL);
+}
+
+Image* apply_lut_into(Image* img, const value_t* lut, Image* dst) {
+	Image* result = prepare_dst(dst, img, NULL, img->channels, img->width, img->height);
+	if (result == NULL)
+		return NULL;
+
+	struct job job = {.img = img, .result = result, .lut = lut};
+	workers_run(lut_band, &job, img->width, img->height);
 
-	for (int i = 0; i < img->height; i++) {
-		for (int j = 0; j < img->width; j++) {
-			for (int c = 0; c < img->channels; c++)
-				set_at(result, c, j, i, MAX_VALUE - get_at(img, c, j, i, 0));
-		}
-	}
-	
 	return result;
 }
 
@@ -324,9 +587,129 @@ Image* invert_image(Image* img) {
 //----------------------------------------------------------------------------------------------------
 
 /*
-functions to read and write .ppm files
+functions to read and write .ppm and .pgm files
+
+binary maps (P5 and P6) are written a row at a time and read by mapping
+the file, the image uses the mapped data directly.
+ascii maps (P2 and P3) are still supported
+*/
+
+/*
+a mapped pixel map, given back by unmap_image when the image is freed
 */
+struct mapping {
+	void* 	base;
+	size_t 	length;
+};
+
+static void unmap_image(Image* img) {
+	struct mapping* map = img->owner;
+	munmap(map->base, map->length);
+	free(map);
+	free(img);
+}
+
+/*
+reads a number of the header or an ascii map,
+whitespace and comments (# until the end of the line) before it are skipped.
+one whitespace after the number is consumed, for the max value it separates the header from the data.
+numbers that do not fit in a size_t are rejected,
+and so is a comment right after the number when it is the last one of a binary header
+*/
+static char read_value(FILE* f, size_t* value, char last) {
+	int c = getc(f);
+	while (c == '#' || isspace(c)) {
+		if (c == '#') {
+			while (c != '\n' && c != EOF)
+				c = getc(f);
+		}
+		c = getc(f);
+	}
+
+	if (!isdigit(c))
+		return 0;
+
+	*value = 0;
+	while (isdigit(c)) {
+		if (*value > (SIZE_MAX - 9) / 10)
+			return 0;
+		*value = *value * 10 + (c - '0');
+		c = getc(f);
+	}
+
+	if (c == '#' && !last) {
+		ungetc(c, f);
+		return 1;
+	}
+	return c == EOF || isspace(c);
+}
+
+/*
+maps the data of a binary map starting at offset,
+returns NULL if the file cannot be mapped
+*/
+static Image* map_pixel_map(FILE* f, long offset, size_t channels, size_t width, size_t height) {
+	struct stat st;
+	if (fstat(fileno(f), &st) != 0 || st.st_size <= offset ||
+		(size_t)(st.st_size - offset) / channels / height < width)
+		return NULL;
+
+	void* base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(f), 0);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	struct mapping* map = malloc(sizeof(struct mapping));
+	Image* 			img = malloc(sizeof(Image));
+	if (map == NULL || img == NULL) {
+		fprintf(stderr, "Cannot allocate image\n");
+		exit(EXIT_FAILURE);
+	}
+
+	map->base 		= base;
+	map->length 	= st.st_size;
+
+	img->channels 	= channels;
+	img->width 		= width;
+	img->height 	= height;
+	img->stride 	= channels * width;
+	img->data 		= (value_t*)base + offset;
+	img->parent 	= NULL;
+	img->refs 		= 1;
+	img->release 	= unmap_image;
+	img->owner 		= map;
+	img->timestamp 	= 0;
+	img->dequeued 	= 0;
+	img->sequence 	= 0;
+	return img;
+}
+
 void write_pixel_map(const char* file, Image* img) {
+	if (img->channels != 3 && img->channels != 1) {
+		fprintf(stderr, "Must have only R G B channels or grayscale to write image\n");
+		return;
+	}
+
+	FILE* f = fopen(file, "wb");
+
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open file\n");
+		return;
+	}
+
+	fprintf(f, "P%c\n%ld %ld %d\n", img->channels == 3 ? '6' : '5', img->width, img->height, MAX_VALUE);
+
+	size_t row_size = img->width * img->channels;
+	if (img->stride == row_size)
+		fwrite(img->data, sizeof(value_t), row_size * img->height, f);
+	else {
+		for (size_t i = 0; i < img->height; i++)
+			fwrite(IMAGE_ROW(img, i), sizeof(value_t), row_size, f);
+	}
+
+	fclose(f);
+}
+
+void write_pixel_map_ascii(const char* file, Image* img) {
 	FILE* f = fopen(file, "w");
 
 	if (f == NULL) {
@@ -362,62 +745,78 @@ void write_pixel_map(const char* file, Image* img) {
 }
 
 /*
-doesn't accept comments
+reads P2, P3, P5 and P6 maps with a max value of up to 255
 */
 Image* read_pixel_map(const char* file) {
-	FILE* f = fopen(file, "r");
+	FILE* f = fopen(file, "rb");
 
 	size_t width, height, max_value;
-	char gray_mode = 0;
-
-	Image* result;
-
-	char buffer[3];
 
 	if (f == NULL) {
 		fprintf(stderr, "Cannot open file\n");
 		return NULL;
 	}
 
-	if (!fgets(buffer, sizeof(buffer), f)) {
-		fprintf(stderr, "Cannot read file\n");
+	int magic = getc(f) == 'P' ? getc(f) : EOF;
+	if (magic != '2' && magic != '3' && magic != '5' && magic != '6') {
+		fprintf(stderr, "Invalid PPM format\n");
 		fclose(f);
 		return NULL;
 	}
 
-	if (buffer[0] == 'P' && buffer[1] == '3')
-		gray_mode = 0;
-	else if (buffer[0] == 'P' && buffer[1] == '2')
-		gray_mode = 1;
-	else {
-		fprintf(stderr, "Invalid PPM format\n");
+	size_t 	channels 	= magic == '3' || magic == '6' ? 3 : 1;
+	char 	binary 		= magic == '5' || magic == '6';
+
+	if (!read_value(f, &width, 0) || !read_value(f, &height, 0) || !read_value(f, &max_value, binary)) {
+		fprintf(stderr, "Invalid PPM header\n");
+		fclose(f);
+		return NULL;
+	}
+
+	if (max_value == 0 || max_value > MAX_VALUE) {
+		fprintf(stderr, "Only 8 bit pixel maps are supported\n");
+		fclose(f);
+		return NULL;
+	}
+
+	// the data of a binary map starts right after the whitespace ending the max value
+	if (width == 0 || height == 0 || width > SIZE_MAX / channels / height) {
+		fprintf(stderr, "Invalid PPM header\n");
 		fclose(f);
 		return NULL;
 	}
-	
-	fscanf(f, "%ld %ld %ld", &width, &height, &max_value);
 
+	size_t 	size 		= channels * width * height;
+	Image* 	result 		= NULL;
+
+	if (binary) {
+		long 		offset = ftell(f);
+		struct stat st;
 
-	if (gray_mode) {
-		result = make_image(1, width, height);
-		for (int i = 0; i < height; i++) {
-			for (int j = 0; j < width; j++) {
-				value_t v;
-				if (fscanf(f, "%hhd", &v))
-					set_at(result, 0, j, i, v);
+		if (offset < 0 || fstat(fileno(f), &st) != 0 || st.st_size < offset ||
+			(size_t)(st.st_size - offset) < size) {
+			fprintf(stderr, "Pixel map is truncated\n");
+			fclose(f);
+			return NULL;
+		}
+
+		result = map_pixel_map(f, offset, channels, width, height);
+		if (result == NULL) { // files that cannot be mapped are read
+			result = alloc_image(channels, width, height);
+			if (fread(result->data, sizeof(value_t), size, f) != size) {
+				fprintf(stderr, "Cannot read file\n");
+				free_image(result);
+				result = NULL;
 			}
 		}
 	}
 	else {
-		result = make_image(3, width, height);
-		for (int i = 0; i < height; i++) {
-			for (int j = 0; j < width; j++) {
-				for (int c = 0; c < 3; c++) {
-					value_t v;
-					if (fscanf(f, "%hhd", &v))
-						set_at(result, c, j, i, v);
-				}
-			}
+		result = make_image(channels, width, height);
+		for (size_t i = 0; i < size; i++) {
+			size_t v;
+			if (!read_value(f, &v, 0))
+				break;
+			result->data[i] = v;
 		}
 	}
 
@@ -434,12 +833,9 @@ char image_equality(Image* img1, Image* img2) {
 		img1->width == img2->width &&
 		img1->height == img2->height) {
 		
-		for (int i = 0; i < img1->height; i++) {
-			for (int j = 0; j < img1->height; j++) {
-				for (int c = 0; c < img1->channels; c++) 
-					if (get_at(img1, c, j, i, 0) != get_at(img2, c, j, i, 0))
-						return 0;
-			}
+		for (size_t i = 0; i < img1->height; i++) {
+			if (memcmp(IMAGE_ROW(img1, i), IMAGE_ROW(img2, i), img1->width * img1->channels) != 0)
+				return 0;
 		}
 		return 1;
 	}
@@ -448,52 +844,85 @@ char image_equality(Image* img1, Image* img2) {
 
 }
 
+/*
+images of different sizes are padded with zeros to the larger size
+*/
 Image* concat_channels(Image* img1, Image* img2) {
+	return concat_channels_into(img1, img2, NULL);
+}
+
+Image* concat_channels_into(Image* img1, Image* img2, Image* dst) {
 	size_t max_width 	= MAX(img1->width, img2->width);
 	size_t max_height 	= MAX(img1->height, img2->height);
 	size_t channels 	= img1->channels + img2->channels;
-	Image* result 		= make_image(channels, max_width, max_height);
+	Image* result 		= prepare_dst(dst, img1, img2, channels, max_width, max_height);
 
-	for (int i = 0; i < max_height; i++) {
-		for (int j = 0; j < max_width; j++){
-			for (int c = 0; c < img1->channels; c++) 
-				set_at(result, c, j, i, get_at(img1, c, j, i, 0));
-
-			for (int c = 0; c < img2->channels; c++) 
-				set_at(result, img1->channels + c, j, i, get_at(img2, c, j, i, 0));
+	if (result == NULL)
+		return NULL;
 
-		}
+	// only the padding needs zeroing, when both images have the same size there is none
+	if (img1->width != img2->width || img1->height != img2->height) {
+		for (size_t i = 0; i < max_height; i++)
+			memset(IMAGE_ROW(result, i), 0, max_width * channels);
 	}
 
+	for (size_t i = 0; i < img1->height; i++)
+		kernel_copy_channels(IMAGE_ROW(img1, i), IMAGE_ROW(result, i), img1->width,
+			img1->channels, channels, 0);
+
+	for (size_t i = 0; i < img2->height; i++)
+		kernel_copy_channels(IMAGE_ROW(img2, i), IMAGE_ROW(result, i), img2->width,
+			img2->channels, channels, img1->channels);
+
 	return result;
 }
 
 
 Image* image_add(Image* img, float x) {
-	return arth_operation(img, &add, x);
+	return arth_operation(img, &add, x, NULL);
 }
 
 Image* image_sub(Image* img, float x) {
-	return arth_operation(img, &subtract, x);
+	return arth_operation(img, &subtract, x, NULL);
 }
 
 Image* image_mul(Image* img, float x) {
-	return arth_operation(img, &multiply, x);
+	return arth_operation(img, &multiply, x, NULL);
 }
 
 Image* image_div(Image* img, float x) {
-	return arth_operation(img, &divide, x);
+	return arth_operation(img, &divide, x, NULL);
+}
+
+Image* image_add_into(Image* img, float x, Image* dst) {
+	return arth_operation(img, &add, x, dst);
+}
+
+Image* image_sub_into(Image* img, float x, Image* dst) {
+	return arth_operation(img, &subtract, x, dst);
+}
+
+Image* image_mul_into(Image* img, float x, Image* dst) {
+	return arth_operation(img, &multiply, x, dst);
+}
+
+Image* image_div_into(Image* img, float x, Image* dst) {
+	return arth_operation(img, &divide, x, dst);
 }
 
 
 Image* image_not(Image* img) {
+	return image_not_into(img, NULL);
+}
+
+Image* image_not_into(Image* img, Image* dst) {
 	if (img->channels == 1) {
-		Image* result = make_image(img->channels, img->width, img->height);
+		Image* result = prepare_dst(dst, img, NULL, 1, img->width, img->height);
+		if (result == NULL)
+			return NULL;
 
-		for (int i = 0; i < img->height; i++) {
-			for (int j = 0; j < img->width; j++)
-				set_at(result, 0, j, i, !get_at(img, 0, j, i, 0));
-		}
+		for (size_t i = 0; i < img->height; i++)
+			kernel_not(IMAGE_ROW(img, i), IMAGE_ROW(result, i), img->width);
 		return result;
 	}
 	else {
@@ -503,15 +932,27 @@ Image* image_not(Image* img) {
 }
 
 Image* image_and(Image* img1, Image* img2) {
-	return logic_operation(img1, img2, &and);
+	return logic_operation(img1, img2, &and, NULL);
 }
 
 Image* image_or(Image* img1, Image* img2) {
-	return logic_operation(img1, img2, &or);
+	return logic_operation(img1, img2, &or, NULL);
 }
 
 Image* image_xor(Image* img1, Image* img2) {
-	return logic_operation(img1, img2, &xor);
+	return logic_operation(img1, img2, &xor, NULL);
 }
 
-//----------------------------------------------------------------------------------------------------
+Image* image_and_into(Image* img1, Image* img2, Image* dst) {
+	return logic_operation(img1, img2, &and, dst);
+}
+
+Image* image_or_into(Image* img1, Image* img2, Image* dst) {
+	return logic_operation(img1, img2, &or, dst);
+}
+
+Image* image_xor_into(Image* img1, Image* img2, Image* dst) {
+	return logic_operation(img1, img2, &xor, dst);
+}
+
+//----------------------------------------------------------------------------------------------------
\ No newline at end of file
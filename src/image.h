@@ -21,26 +21,96 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "common.h"
 
-typedef struct {
-	size_t		channels;
-	size_t		width;
-	size_t		height;
-	value_t*	data;
+/*
+an image either owns its data or is a view on a region of another image.
+views share the data of their parent, which is kept alive until
+every view on it is freed
+
+data that doesn't come from the pool (a mapped file for example)
+is given back by the release function of the image
+
+views keep the frame times of their parent
+*/
+typedef struct Image {
+	size_t			channels;
+	size_t			width;
+	size_t			height;
+	size_t 			stride; 	// values from the start of one row to the next
+	value_t*		data;
+	struct Image* 	parent; 	// image owning the data, NULL if the data is owned
+	int 			refs; 		// references to the image, one for itself and one for every view
+	void 			(*release)(struct Image* img); // frees the image, NULL for pool images
+	void* 			owner; 		// whatever release needs to free the data
+
+	// frames of a device, 0 for other images
+	uint64_t 		timestamp; 	// capture time in ns on the monotonic clock, set by the driver
+	uint64_t 		dequeued; 	// time in ns on the monotonic clock when the frame was read
+	unsigned int 	sequence; 	// frame number given by the driver
 } Image;
 
+/*
+hsv scales
+
+HSV_FLOAT	hue in degrees stored in a byte (wraps above 255), saturation and value in percents
+HSV_FIXED	hue in 0-179 (half degrees), saturation and value in 0-255, integer math only
+*/
+enum hsv_scale {
+	HSV_FLOAT,
+	HSV_FIXED,
+};
+
+/*
+sobel outputs, magnitudes are saturated at 255
+
+SOBEL_L1	|gx| + |gy|
+SOBEL_L2	sqrt(gx^2 + gy^2)
+SOBEL_RAW	two channels, gx/8 + 128 and gy/8 + 128
+*/
+enum sobel_norm {
+	SOBEL_L1,
+	SOBEL_L2,
+	SOBEL_RAW,
+};
+
+/*
+pointer to the first value of row Y
+*/
+#define IMAGE_ROW(IMG, Y) ((IMG)->data + (Y) * (IMG)->stride)
+
 // COMMON FUNCTIONS
 //----------------------------------------------------------------------------------------------------
 
 Image* 		make_image(size_t channels, size_t width, size_t height);
 void 		free_image(Image* img);
+Image* 		make_view(Image* img, size_t x, size_t y, size_t width, size_t height);
 value_t 	get_at(Image* img, size_t chnl, size_t x, size_t y, value_t def_value);
 void 		set_at(Image* img, size_t chnl, size_t x, size_t y, value_t value);
 Image* 		split_channel(Image* img, size_t c);
 Image* 		in_range(Image* img, value_t* lower, value_t* upper, value_t on, value_t off);
-Image* 		rgb_to_hsv(Image* img);
+Image* 		rgb_to_hsv(Image* img, enum hsv_scale scale);
+Image* 		hsv_in_range(Image* img, enum hsv_scale scale, value_t* lower, value_t* upper, value_t on, value_t off);
 Image* 		grayscale(Image* img);
-Image* 		sobel(Image* img);
+Image* 		sobel(Image* img, enum sobel_norm norm);
 Image* 		invert_image(Image* img);
+Image* 		apply_lut(Image* img, const value_t* lut);
+
+//----------------------------------------------------------------------------------------------------
+
+// COMMON FUNCTIONS WITH DESTINATION
+//----------------------------------------------------------------------------------------------------
+
+Image* 		split_channel_into(Image* img, size_t c, Image* dst);
+Image* 		in_range_into(Image* img, value_t* lower, value_t* upper, value_t on, value_t off, Image* dst);
+Image* 		rgb_to_hsv_into(Image* img, enum hsv_scale scale, Image* dst);
+Image* 		hsv_in_range_into(Image* img, enum hsv_scale scale, value_t* lower, value_t* upper,
+				value_t on, value_t off, Image* dst);
+Image* 		grayscale_into(Image* img, Image* dst);
+Image* 		sobel_into(Image* img, enum sobel_norm norm, Image* dst);
+Image* 		invert_image_into(Image* img, Image* dst);
+Image* 		apply_lut_into(Image* img, const value_t* lut, Image* dst);
+
+// checks or makes the destination of a function, for modules making images (see image.c)
+Image* 		prepare_dst(Image* dst, Image* src1, Image* src2, size_t channels, size_t width, size_t height);
 
 //----------------------------------------------------------------------------------------------------
 
@@ -48,6 +118,7 @@ Image* 		invert_image(Image* img);
 //----------------------------------------------------------------------------------------------------
 
 void 	write_pixel_map(const char* file, Image* img);
+void 	write_pixel_map_ascii(const char* file, Image* img);
 Image* 	read_pixel_map(const char* file);
 
 //----------------------------------------------------------------------------------------------------
@@ -66,6 +137,16 @@ Image* 	image_and(Image* img1, Image* img2);
 Image* 	image_or(Image* img1, Image* img2);
 Image* 	image_xor(Image* img1, Image* img2);
 
+Image* 	concat_channels_into(Image* img1, Image* img2, Image* dst);
+Image* 	image_add_into(Image* img, float x, Image* dst);
+Image* 	image_sub_into(Image* img, float x, Image* dst);
+Image* 	image_mul_into(Image* img, float x, Image* dst);
+Image* 	image_div_into(Image* img, float x, Image* dst);
+Image* 	image_not_into(Image* img, Image* dst);
+Image* 	image_and_into(Image* img1, Image* img2, Image* dst);
+Image* 	image_or_into(Image* img1, Image* img2, Image* dst);
+Image* 	image_xor_into(Image* img1, Image* img2, Image* dst);
+
 //----------------------------------------------------------------------------------------------------
 
 
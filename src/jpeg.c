@@ -0,0 +1,122 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "jpeg.h"
+#include "pool.h"
+
+#ifdef KESTREL_JPEG
+
+#include <setjmp.h>
+#include <jpeglib.h>
+
+// HELPERS
+//----------------------------------------------------------------------------------------------------
+
+/*
+libjpeg exits on errors by default, errors jump back to decode_jpeg instead
+*/
+struct error_manager {
+	struct jpeg_error_mgr 	base;
+	jmp_buf 				jump;
+};
+
+static void error_exit(j_common_ptr cinfo) {
+	struct error_manager* err = (struct error_manager*)cinfo->err;
+	longjmp(err->jump, 1);
+}
+
+/*
+usb cameras often send frames with small defects, the warnings are not printed
+*/
+static void output_message(j_common_ptr cinfo) {
+	(void)cinfo;
+}
+
+//----------------------------------------------------------------------------------------------------
+
+// DECODING
+//----------------------------------------------------------------------------------------------------
+
+Image* decode_jpeg(const value_t* data, size_t length, size_t scale, char gray) {
+	if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+		fprintf(stderr, "Jpeg scale must be 1, 2, 4 or 8\n");
+		return NULL;
+	}
+
+	struct jpeg_decompress_struct 	cinfo;
+	struct error_manager 			err;
+	Image* volatile 				img = NULL;
+
+	cinfo.err 					= jpeg_std_error(&err.base);
+	err.base.error_exit 		= error_exit;
+	err.base.output_message 	= output_message;
+
+	if (setjmp(err.jump)) {
+		jpeg_destroy_decompress(&cinfo);
+		if (img)
+			free_image(img);
+		return NULL;
+	}
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, (unsigned char*)data, length);
+	jpeg_read_header(&cinfo, TRUE);
+
+	// the chroma is not decoded at all for grayscale output
+	cinfo.scale_num 		= 1;
+	cinfo.scale_denom 		= scale;
+	cinfo.out_color_space 	= gray ? JCS_GRAYSCALE : JCS_RGB;
+	cinfo.dct_method 		= JDCT_IFAST;
+
+	jpeg_start_decompress(&cinfo);
+
+	img = pool_acquire(cinfo.output_components, cinfo.output_width, cinfo.output_height);
+	while (cinfo.output_scanline < cinfo.output_height) {
+		JSAMPROW row = IMAGE_ROW(img, cinfo.output_scanline);
+		jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+
+	return img;
+}
+
+char jpeg_supported() {
+	return 1;
+}
+
+//----------------------------------------------------------------------------------------------------
+
+#else
+
+Image* decode_jpeg(const value_t* data, size_t length, size_t scale, char gray) {
+	(void)data;
+	(void)length;
+	(void)scale;
+	(void)gray;
+
+	fprintf(stderr, "Kestrel was built without jpeg support\n");
+	return NULL;
+}
+
+char jpeg_supported() {
+	return 0;
+}
+
+#endif
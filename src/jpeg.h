@@ -0,0 +1,36 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef JPEG_H
+#define JPEG_H
+
+#include "common.h"
+#include "image.h"
+
+/*
+jpeg decoding for mjpeg cameras, kestrel must be built with KESTREL_JPEG
+and linked with libjpeg (the Makefile does so when libjpeg is installed)
+
+scale is 1, 2, 4 or 8, the image is decoded at 1/scale of its size
+while still in the dct domain. gray only decodes the luma.
+returns NULL if the data can't be decoded
+*/
+Image* 	decode_jpeg(const value_t* data, size_t length, size_t scale, char gray);
+char 	jpeg_supported();
+
+#endif
@@ -0,0 +1,468 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "kernel.h"
+#include "simd.h"
+
+#define MIN(MIN_A,MIN_B) (((MIN_A)<(MIN_B))?(MIN_A):(MIN_B))
+#define MAX(MAX_A,MAX_B) (((MAX_A)>(MAX_B))?(MAX_A):(MAX_B))
+
+#define HSV_BLOCK 128 // pixels converted at once by the fused fixed point kernel
+
+// HELPERS
+//----------------------------------------------------------------------------------------------------
+
+typedef size_t (*in_range_fn)(const value_t* src, value_t* dst, size_t width,
+		const value_t* lower, const value_t* upper, value_t on, value_t off);
+
+typedef size_t (*hsv_fn)(const value_t* src, value_t* dst, size_t width,
+		const int* sdiv_table, const int* hdiv_table);
+
+typedef size_t (*sobel_fn)(const int16_t* smooth, const int16_t* diff, value_t* dst, size_t width,
+		enum sobel_norm norm);
+
+typedef size_t (*lut_fn)(const value_t* src, value_t* dst, size_t n, const value_t* lut);
+
+typedef size_t (*pack_fn)(const value_t* src, uint64_t* dst, size_t width);
+
+typedef size_t (*luma_fn)(const value_t* src, value_t* dst, size_t width);
+
+typedef size_t (*yuyv_fn)(const value_t* src, value_t* dst, size_t width);
+
+typedef size_t (*nv12_fn)(const value_t* y, const value_t* uv, value_t* dst, size_t width);
+
+struct backend {
+	const char* 	name;
+	in_range_fn 	in_range1;
+	in_range_fn 	in_range3;
+	hsv_fn 			hsv_fixed;
+	sobel_fn 		sobel;
+	lut_fn 			lut;
+	pack_fn 		pack;
+	luma_fn 		luma;
+	yuyv_fn 		yuyv_rgb;
+	nv12_fn 		nv12_rgb;
+};
+
+/*
+backends ordered from the slowest to the fastest,
+the scalar backend has no vector kernels and leaves everything to the loops below
+*/
+static const struct backend backends[] = {
+	{"scalar", 	NULL, 				NULL, 				NULL, 					NULL, 			NULL, 		NULL, 				NULL,
+		NULL, 				NULL},
+#ifdef KESTREL_X86
+	{"sse2", 	sse2_in_range1, 	sse2_in_range3, 	NULL, 					sse2_sobel, 	NULL, 		sse2_pack_mask, 	sse2_yuyv_luma,
+		sse2_yuyv_to_rgb, 	sse2_nv12_to_rgb},
+	{"avx2", 	avx2_in_range1, 	avx2_in_range3, 	avx2_rgb_to_hsv_fixed, 	sse2_sobel, 	avx2_lut, 	avx2_pack_mask, 	avx2_yuyv_luma,
+		avx2_yuyv_to_rgb, 	avx2_nv12_to_rgb},
+#endif
+};
+
+static size_t supported 			= 1; // amount of backends the cpu can run
+static const struct backend* active = &backends[0];
+
+static int 	sdiv_table[MAX_VALUE +1];
+static int 	hdiv_table[MAX_VALUE +1];
+static char tables_ready = 0;
+
+static void make_hsv_tables() {
+	sdiv_table[0] = hdiv_table[0] = 0;
+	for (int i = 1; i <= MAX_VALUE; i++) {
+		sdiv_table[i] = (int)lround((double)(MAX_VALUE << HSV_SHIFT) / i);
+		hdiv_table[i] = (int)lround((double)(180 << HSV_SHIFT) / (6.0 * i));
+	}
+	tables_ready = 1;
+}
+
+/*
+converts a single rgb pixel to hsv
+hue is in degrees and saturation and value are in percents
+*/
+static inline void hsv_pixel(const value_t* p, value_t* hsv) {
+	float r 	= (float)p[0]/255;
+	float g 	= (float)p[1]/255;
+	float b		= (float)p[2]/255;
+	float max 	= MAX(MAX(r, g), b);
+	float min 	= MIN(MIN(r, g), b);
+	float df	= max - min;
+	if (df == 0)
+		hsv[0] = 0;
+	else if (max == r)
+		hsv[0] = (value_t)((int)(60 * ((g-b)/df) + 360) % 360);
+	else if (max == g)
+		hsv[0] = (value_t)((int)(60 * ((b-r)/df) + 120) % 360);
+	else
+		hsv[0] = (value_t)((int)(60 * ((r-g)/df) + 240) % 360);
+
+	hsv[1] = max == 0 ? 0 : (value_t)((df/max)*100);
+	hsv[2] = (value_t)(max*100);
+}
+
+/*
+fixed point version of hsv_pixel, no divisions
+hue is in half degrees (0-179) and saturation and value are in 0-255
+*/
+static inline void hsv_fixed_pixel(const value_t* p, value_t* hsv) {
+	int r 		= p[0], g = p[1], b = p[2];
+	int max 	= MAX(MAX(r, g), b);
+	int min 	= MIN(MIN(r, g), b);
+	int df 		= max - min;
+	int half 	= 1 << (HSV_SHIFT -1);
+
+	int h;
+	if (max == r)
+		h = g - b;
+	else if (max == g)
+		h = b - r + 2 * df;
+	else
+		h = r - g + 4 * df;
+
+	h = (h * hdiv_table[df] + half) >> HSV_SHIFT;
+	if (h < 0)
+		h += 180;
+
+	hsv[0] = h;
+	hsv[1] = (df * sdiv_table[max] + half) >> HSV_SHIFT;
+	hsv[2] = max;
+}
+
+//----------------------------------------------------------------------------------------------------
+
+// DISPATCH
+//----------------------------------------------------------------------------------------------------
+
+/*
+detects the cpu features and picks the fastest backend
+*/
+void kernel_init() {
+	supported = 1;
+#ifdef KESTREL_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		supported = 2;
+	if (supported == 2 && __builtin_cpu_supports("avx2"))
+		supported = 3;
+#endif
+	active = &backends[supported -1];
+
+	if (!tables_ready)
+		make_hsv_tables();
+}
+
+const char* kernel_backend() {
+	return active->name;
+}
+
+/*
+forces a backend, used for benchmarking and comparing results
+returns 0 if the backend is unknown or not supported by the cpu
+*/
+char kernel_set_backend(const char* name) {
+	for (size_t i = 0; i < supported; i++) {
+		if (strcmp(backends[i].name, name) == 0) {
+			active = &backends[i];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+
+/*
+the loops below are kept simple and branch free where possible
+so the compiler is able to vectorize them
+*/
+
+// ROW KERNELS
+//----------------------------------------------------------------------------------------------------
+
+void kernel_split_channel(const value_t* restrict src, value_t* restrict dst, size_t width, size_t chnls, size_t c) {
+	src += c;
+	for (size_t j = 0; j < width; j++)
+		dst[j] = src[j * chnls];
+}
+
+void kernel_in_range(const value_t* restrict src, value_t* restrict dst, size_t width, size_t chnls,
+		const value_t* lower, const value_t* upper, value_t on, value_t off) {
+
+	size_t done = 0;
+	if (chnls == 1 && active->in_range1)
+		done = active->in_range1(src, dst, width, lower, upper, on, off);
+	else if (chnls == 3 && active->in_range3)
+		done = active->in_range3(src, dst, width, lower, upper, on, off);
+
+	if (chnls == 1) {
+		value_t lo = lower[0], hi = upper[0];
+		for (size_t j = done; j < width; j++)
+			dst[j] = (src[j] >= lo && src[j] <= hi) ? on : off;
+	}
+	else if (chnls == 3) {
+		value_t lo0 = lower[0], lo1 = lower[1], lo2 = lower[2];
+		value_t hi0 = upper[0], hi1 = upper[1], hi2 = upper[2];
+		for (size_t j = done; j < width; j++) {
+			const value_t* p = src + j * 3;
+			dst[j] = (p[0] >= lo0 && p[0] <= hi0 &&
+					p[1] >= lo1 && p[1] <= hi1 &&
+					p[2] >= lo2 && p[2] <= hi2) ? on : off;
+		}
+	}
+	else {
+		for (size_t j = 0; j < width; j++) {
+			const value_t* 	p 		= src + j * chnls;
+			value_t 		is_on 	= on;
+			for (size_t c = 0; c < chnls; c++)
+				if (p[c] < lower[c] || p[c] > upper[c])
+					is_on = off;
+			dst[j] = is_on;
+		}
+	}
+}
+
+void kernel_rgb_to_hsv(const value_t* restrict src, value_t* restrict dst, size_t width, enum hsv_scale scale) {
+	if (scale == HSV_FIXED) {
+		if (!tables_ready)
+			make_hsv_tables();
+
+		size_t done = 0;
+		if (active->hsv_fixed)
+			done = active->hsv_fixed(src, dst, width, sdiv_table, hdiv_table);
+
+		for (size_t j = done; j < width; j++)
+			hsv_fixed_pixel(src + j * 3, dst + j * 3);
+	}
+	else {
+		for (size_t j = 0; j < width; j++, src += 3, dst += 3)
+			hsv_pixel(src, dst);
+	}
+}
+
+/*
+the fixed scale converts blocks of the row into a small buffer
+and thresholds them with the in range kernel while they are still in cache
+*/
+void kernel_hsv_in_range(const value_t* restrict src, value_t* restrict dst, size_t width, enum hsv_scale scale,
+		const value_t* lower, const value_t* upper, value_t on, value_t off) {
+	if (scale == HSV_FIXED) {
+		value_t block[HSV_BLOCK * 3];
+		for (size_t j = 0; j < width; j += HSV_BLOCK) {
+			size_t n = MIN(HSV_BLOCK, width - j);
+			kernel_rgb_to_hsv(src + j * 3, block, n, HSV_FIXED);
+			kernel_in_range(block, dst + j, n, 3, lower, upper, on, off);
+		}
+		return;
+	}
+
+	for (size_t j = 0; j < width; j++, src += 3) {
+		value_t hsv[3];
+		hsv_pixel(src, hsv);
+		dst[j] = (hsv[0] >= lower[0] && hsv[0] <= upper[0] &&
+				hsv[1] >= lower[1] && hsv[1] <= upper[1] &&
+				hsv[2] >= lower[2] && hsv[2] <= upper[2]) ? on : off;
+	}
+}
+
+void kernel_grayscale(const value_t* restrict src, value_t* restrict dst, size_t width, size_t chnls) {
+	if (chnls == 1)
+		memcpy(dst, src, width);
+	else if (chnls == 3) {
+		for (size_t j = 0; j < width; j++)
+			dst[j] = ((unsigned)src[j*3] + src[j*3 +1] + src[j*3 +2]) / 3;
+	}
+	else {
+		for (size_t j = 0; j < width; j++) {
+			unsigned sum = 0;
+			for (size_t c = 0; c < chnls; c++)
+				sum += src[j * chnls + c];
+			dst[j] = sum / chnls;
+		}
+	}
+}
+
+/*
+vertical sobel pass
+smooth is up + 2 mid + down and diff is down - up
+*/
+void kernel_sobel_vertical(const value_t* restrict up, const value_t* restrict mid, const value_t* restrict down,
+		int16_t* restrict smooth, int16_t* restrict diff, size_t width) {
+	for (size_t j = 0; j < width; j++) {
+		smooth[j] 	= up[j] + 2 * mid[j] + down[j];
+		diff[j] 	= down[j] - up[j];
+	}
+}
+
+/*
+horizontal sobel pass, smooth and diff must have one valid value before and after the row
+	gx = smooth[x +1] - smooth[x -1]
+	gy = diff[x -1] + 2 diff[x] + diff[x +1]
+*/
+void kernel_sobel_horizontal(const int16_t* smooth, const int16_t* diff, value_t* restrict dst, size_t width,
+		enum sobel_norm norm) {
+	size_t done = 0;
+	if (active->sobel)
+		done = active->sobel(smooth, diff, dst, width, norm);
+
+	for (size_t j = done; j < width; j++) {
+		int gx = smooth[j +1] - smooth[j -1];
+		int gy = diff[j -1] + 2 * diff[j] + diff[j +1];
+
+		if (norm == SOBEL_L1) {
+			int m 	= abs(gx) + abs(gy);
+			dst[j] 	= m > MAX_VALUE ? MAX_VALUE : m;
+		}
+		else if (norm == SOBEL_L2) {
+			int m 	= gx * gx + gy * gy;
+			dst[j] 	= m >= MAX_VALUE * MAX_VALUE ? MAX_VALUE : (value_t)sqrtf((float)m);
+		}
+		else {
+			dst[j * 2] 		= (gx >> 3) + 128;
+			dst[j * 2 +1] 	= (gy >> 3) + 128;
+		}
+	}
+}
+
+void kernel_invert(const value_t* restrict src, value_t* restrict dst, size_t n) {
+	for (size_t j = 0; j < n; j++)
+		dst[j] = MAX_VALUE - src[j];
+}
+
+/*
+dst[j] = lut[src[j]], lut has MAX_VALUE +1 entries
+*/
+void kernel_lut(const value_t* restrict src, value_t* restrict dst, size_t n, const value_t* restrict lut) {
+	size_t j = 0;
+	if (active->lut)
+		j = active->lut(src, dst, n, lut);
+
+	for (; j +4 <= n; j += 4) {
+		value_t a = lut[src[j]];
+		value_t b = lut[src[j +1]];
+		value_t c = lut[src[j +2]];
+		value_t d = lut[src[j +3]];
+		dst[j] 		= a;
+		dst[j +1] 	= b;
+		dst[j +2] 	= c;
+		dst[j +3] 	= d;
+	}
+	for (; j < n; j++)
+		dst[j] = lut[src[j]];
+}
+
+void kernel_logic(const value_t* a, const value_t* b, value_t* restrict dst, size_t n, value_t (*fn)(value_t a, value_t b)) {
+	for (size_t j = 0; j < n; j++)
+		dst[j] = (*fn)(a[j], b[j]);
+}
+
+void kernel_not(const value_t* restrict src, value_t* restrict dst, size_t n) {
+	for (size_t j = 0; j < n; j++)
+		dst[j] = !src[j];
+}
+
+/*
+sets bit x of dst if src[x] is not 0, see mask.h for the layout.
+the bits past width in the last word are cleared
+*/
+void kernel_pack_mask(const value_t* restrict src, uint64_t* restrict dst, size_t width) {
+	size_t x = 0;
+	if (active->pack)
+		x = active->pack(src, dst, width);
+
+	for (; x < width; x += 64) {
+		uint64_t word 	= 0;
+		size_t 	 n 		= MIN(64, width - x);
+		for (size_t b = 0; b < n; b++)
+			word |= (uint64_t)(src[x + b] != 0) << b;
+		dst[x / 64] = word;
+	}
+}
+
+void kernel_unpack_mask(const uint64_t* restrict src, value_t* restrict dst, size_t width, value_t on, value_t off) {
+	for (size_t x = 0; x < width; x++)
+		dst[x] = (src[x / 64] >> (x % 64)) & 1 ? on : off;
+}
+
+/*
+bt.601 limited range yuv to rgb in fixed point
+*/
+static inline value_t clamp_value(int v) {
+	return v < 0 ? 0 : v > MAX_VALUE ? MAX_VALUE : v;
+}
+
+static inline void yuv_pixel(int y, int u, int v, value_t* rgb) {
+	int c = 298 * (y - 16) + 128;
+	int d = u - 128;
+	int e = v - 128;
+	rgb[0] = clamp_value((c + 409 * e) >> 8);
+	rgb[1] = clamp_value((c - 100 * d - 208 * e) >> 8);
+	rgb[2] = clamp_value((c + 516 * d) >> 8);
+}
+
+/*
+yuyv rows hold two pixels in four values, y0 u y1 v
+*/
+void kernel_yuyv_to_gray(const value_t* restrict src, value_t* restrict dst, size_t width) {
+	size_t j = 0;
+	if (active->luma)
+		j = active->luma(src, dst, width);
+
+	for (; j < width; j++)
+		dst[j] = src[j * 2];
+}
+
+/*
+width must be even, pixel pairs share their u and v
+*/
+void kernel_yuyv_to_rgb(const value_t* restrict src, value_t* restrict dst, size_t width) {
+	size_t j = 0;
+	if (active->yuyv_rgb)
+		j = active->yuyv_rgb(src, dst, width);
+
+	for (src += j * 2, dst += j * 3; j < width; j += 2, src += 4, dst += 6) {
+		yuv_pixel(src[0], src[1], src[3], dst);
+		yuv_pixel(src[2], src[1], src[3], dst + 3);
+	}
+}
+
+/*
+nv12 has a plane of y and a plane of interleaved u v at half the resolution,
+uv is the row of the second plane for the row of y. width must be even
+*/
+void kernel_nv12_to_rgb(const value_t* restrict y, const value_t* restrict uv, value_t* restrict dst, size_t width) {
+	size_t j = 0;
+	if (active->nv12_rgb)
+		j = active->nv12_rgb(y, uv, dst, width);
+
+	for (dst += j * 3; j < width; j += 2, dst += 6) {
+		yuv_pixel(y[j], uv[j], uv[j +1], dst);
+		yuv_pixel(y[j +1], uv[j], uv[j +1], dst + 3);
+	}
+}
+
+/*
+copies every channel of src into dst starting at channel offset
+*/
+void kernel_copy_channels(const value_t* restrict src, value_t* restrict dst, size_t width,
+		size_t src_chnls, size_t dst_chnls, size_t offset) {
+	dst += offset;
+	for (size_t j = 0; j < width; j++)
+		for (size_t c = 0; c < src_chnls; c++)
+			dst[j * dst_chnls + c] = src[j * src_chnls + c];
+}
+
+//----------------------------------------------------------------------------------------------------
@@ -0,0 +1,69 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include "common.h"
+#include "image.h"
+
+/*
+row kernels used by the image functions
+
+kernels work on raw rows and do no bounds checking,
+the caller is responsible for passing rows that are at least width pixels long
+*/
+
+// DISPATCH
+//----------------------------------------------------------------------------------------------------
+
+void 		kernel_init();
+const char* kernel_backend();
+char 		kernel_set_backend(const char* name);
+
+//----------------------------------------------------------------------------------------------------
+
+// ROW KERNELS
+//----------------------------------------------------------------------------------------------------
+
+void kernel_split_channel(const value_t* src, value_t* dst, size_t width, size_t chnls, size_t c);
+void kernel_in_range(const value_t* src, value_t* dst, size_t width, size_t chnls,
+		const value_t* lower, const value_t* upper, value_t on, value_t off);
+void kernel_rgb_to_hsv(const value_t* src, value_t* dst, size_t width, enum hsv_scale scale);
+void kernel_hsv_in_range(const value_t* src, value_t* dst, size_t width, enum hsv_scale scale,
+		const value_t* lower, const value_t* upper, value_t on, value_t off);
+void kernel_grayscale(const value_t* src, value_t* dst, size_t width, size_t chnls);
+void kernel_sobel_vertical(const value_t* up, const value_t* mid, const value_t* down,
+		int16_t* smooth, int16_t* diff, size_t width);
+void kernel_sobel_horizontal(const int16_t* smooth, const int16_t* diff, value_t* dst, size_t width,
+		enum sobel_norm norm);
+void kernel_invert(const value_t* src, value_t* dst, size_t n);
+void kernel_lut(const value_t* src, value_t* dst, size_t n, const value_t* lut);
+void kernel_logic(const value_t* a, const value_t* b, value_t* dst, size_t n, value_t (*fn)(value_t a, value_t b));
+void kernel_not(const value_t* src, value_t* dst, size_t n);
+void kernel_pack_mask(const value_t* src, uint64_t* dst, size_t width);
+void kernel_unpack_mask(const uint64_t* src, value_t* dst, size_t width, value_t on, value_t off);
+void kernel_copy_channels(const value_t* src, value_t* dst, size_t width,
+		size_t src_chnls, size_t dst_chnls, size_t offset);
+void kernel_yuyv_to_gray(const value_t* src, value_t* dst, size_t width);
+void kernel_yuyv_to_rgb(const value_t* src, value_t* dst, size_t width);
+void kernel_nv12_to_rgb(const value_t* y, const value_t* uv, value_t* dst, size_t width);
+
+//----------------------------------------------------------------------------------------------------
+
+#endif
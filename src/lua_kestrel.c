@@ -20,15 +20,26 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <lauxlib.h>
 #include <luaconf.h>
 #include <lualib.h>
+#include <time.h>
 
 #define IMAGE_MT	"kestrel-image"
 #define DEVICE_MT 	"kestrel-device"
 #define CONTOUR_MT 	"kestrel-contour"
+#define MASK_MT 	"kestrel-mask"
+#define GROUP_MT 	"kestrel-group"
+#define STATE_MT 	"kestrel-state"
 
 #include "common.h"
 #include "image.h"
 #include "device.h"
+#include "record.h"
 #include "contour.h"
+#include "mask.h"
+#include "kernel.h"
+#include "pool.h"
+#include "workers.h"
+#include "yuv.h"
+#include "group.h"
 
 #define MIN(MIN_A,MIN_B) (((MIN_A)<(MIN_B))?(MIN_A):(MIN_B))
 #define MAX(MAX_A,MAX_B) (((MAX_A)>(MAX_B))?(MAX_A):(MAX_B))
@@ -54,6 +65,130 @@ static int put_number_in_table(lua_State* L, const char* i, float v) {
 	lua_settable(L, -3);
 }
 
+/*
+reads the lower and upper tables at index and index +1 into lowers and uppers
+returns 0 if the tables lengths don't match the amount of channels
+*/
+static int get_bounds(lua_State* L, int index, size_t chnls, value_t* lowers, value_t* uppers) {
+	luaL_checktype(L, index, LUA_TTABLE);
+	luaL_checktype(L, index +1, LUA_TTABLE);
+
+	if (luaL_len(L, index) != chnls || luaL_len(L, index +1) != chnls)
+		return 0;
+
+	for (int i = 1; i <= chnls; i++) {
+		// pushing index to get value
+		get_index_integer(L, index, i);
+		lowers[i-1] = lua_tointeger(L, -1);
+
+		get_index_integer(L, index +1, i);
+		uppers[i-1] = lua_tointeger(L, -1);
+
+		lua_pop(L, 2);
+	}
+	return 1;
+}
+
+/*
+reads a lookup table at index into lut, either a table of MAX_VALUE +1 values
+where entry v +1 is the new value of v, or a function called with every value.
+values are rounded and clamped to 0-MAX_VALUE
+*/
+static void get_lut(lua_State* L, int index, value_t* lut) {
+	char is_fn = lua_isfunction(L, index);
+	if (!is_fn) {
+		luaL_checktype(L, index, LUA_TTABLE);
+		luaL_argcheck(L, luaL_len(L, index) == MAX_VALUE +1, index, "lookup table must have 256 values");
+	}
+
+	for (int v = 0; v <= MAX_VALUE; v++) {
+		if (is_fn) {
+			lua_pushvalue(L, index);
+			lua_pushinteger(L, v);
+			lua_call(L, 1, 1);
+		}
+		else
+			get_index_integer(L, index, v +1);
+
+		// curves usually return fractions, nan is taken as 0
+		lua_Number nv = luaL_checknumber(L, -1);
+		lut[v] = !(nv > 0) ? 0 : (nv >= MAX_VALUE ? MAX_VALUE : (value_t)(nv + 0.5));
+		lua_pop(L, 1);
+	}
+}
+
+/*
+like luaL_checkudata but raises an error for released images
+*/
+static Image** check_image(lua_State* L, int index) {
+	Image** pimg = luaL_checkudata(L, index, IMAGE_MT);
+	if (*pimg == NULL)
+		luaL_error(L, "image was released");
+	return pimg;
+}
+
+/*
+image functions take an optional destination image as their last argument,
+first is the first index it can be at.
+returns the index of the destination or 0 if there is none
+
+unary metamethods get their operand twice, so the first argument is never a destination
+*/
+static int dst_index(lua_State* L, int first) {
+	int top = lua_gettop(L);
+	if (top >= first && !lua_rawequal(L, top, 1) && luaL_testudata(L, top, IMAGE_MT))
+		return top;
+	else
+		return 0;
+}
+
+static Image* dst_image(lua_State* L, int dst) {
+	return dst ? *check_image(L, dst) : NULL;
+}
+
+/*
+optional arguments that come before the destination image
+*/
+static lua_Integer opt_arg_integer(lua_State* L, int index, int dst, lua_Integer def) {
+	if (dst && index >= dst)
+		return def;
+	return luaL_optinteger(L, index, def);
+}
+
+/*
+reads an optional hsv scale name, "float" (default) or "fixed"
+*/
+static enum hsv_scale opt_hsv_scale(lua_State* L, int index, int dst) {
+	const char* const names[] = {"float", "fixed", NULL};
+	const enum hsv_scale scales[] = {HSV_FLOAT, HSV_FIXED};
+
+	if (dst && index >= dst)
+		return HSV_FLOAT;
+	return scales[luaL_checkoption(L, index, "float", names)];
+}
+
+/*
+reads a yuv format name, "yuyv" or "nv12" (see yuv.h)
+*/
+static enum yuv_format check_yuv_format(lua_State* L, int index) {
+	const char* const names[] = {"yuyv", "nv12", NULL};
+	const enum yuv_format formats[] = {YUV_YUYV, YUV_NV12};
+
+	return formats[luaL_checkoption(L, index, NULL, names)];
+}
+
+/*
+reads an optional sobel norm name, "l2" (default), "l1" or "raw"
+*/
+static enum sobel_norm opt_sobel_norm(lua_State* L, int index, int dst) {
+	const char* const names[] = {"l2", "l1", "raw", NULL};
+	const enum sobel_norm norms[] = {SOBEL_L2, SOBEL_L1, SOBEL_RAW};
+
+	if (dst && index >= dst)
+		return SOBEL_L2;
+	return norms[luaL_checkoption(L, index, "l2", names)];
+}
+
 static int push_image(lua_State* L, Image* img) {
 	Image** pimg = (Image**)lua_newuserdata(L, sizeof(Image*));
 
@@ -61,6 +196,38 @@ static int push_image(lua_State* L, Image* img) {
 
 	luaL_getmetatable(L, IMAGE_MT);
 	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+static int push_mask(lua_State* L, Mask* msk) {
+	if (msk == NULL)
+		return 0;
+
+	Mask** pmsk = (Mask**)lua_newuserdata(L, sizeof(Mask*));
+
+	*pmsk = msk;
+
+	luaL_getmetatable(L, MASK_MT);
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+/*
+pushes the result of an image function,
+when a destination was given its userdata is returned instead of a new one
+*/
+static int push_result(lua_State* L, Image* result, int dst) {
+	if (result == NULL)
+		return 0;
+
+	if (dst)
+		lua_pushvalue(L, dst);
+	else
+		push_image(L, result);
+
+	return 1;
 }
 
 //----------------------------------------------------------------------------------------------------
@@ -80,32 +247,95 @@ static int lua_new_image(lua_State* L) {
 }
 
 static int lua_rgb_to_hsv(lua_State* L) {
-	Image** pimg 	= luaL_checkudata(L, 1, IMAGE_MT);
-	Image* 	hsv 	= rgb_to_hsv(*pimg);
+	Image** pimg 	= check_image(L, 1);
+	int 	dst 	= dst_index(L, 2);
+	Image* 	hsv 	= rgb_to_hsv_into(*pimg, opt_hsv_scale(L, 2, dst), dst_image(L, dst));
 
-	push_image(L, hsv);
-	
-	return 1;
+	return push_result(L, hsv, dst);
 }
 
 static int lua_grayscale(lua_State* L) {
-	Image** pimg 	= luaL_checkudata(L, 1, IMAGE_MT);
-	Image* 	gray 	= grayscale(*pimg);
-
-	push_image(L, gray);
-	
-	return 1;
+	Image** pimg 	= check_image(L, 1);
+	int 	dst 	= dst_index(L, 2);
+	Image* 	gray 	= grayscale_into(*pimg, dst_image(L, dst));
 
+	return push_result(L, gray, dst);
 }
 
 static int lua_sobel(lua_State* L) {
-	Image** pimg 	= luaL_checkudata(L, 1, IMAGE_MT);
-	Image* 	sbl 	= sobel(*pimg);
+	Image** pimg 	= check_image(L, 1);
+	int 	dst 	= dst_index(L, 2);
+	Image* 	sbl 	= sobel_into(*pimg, opt_sobel_norm(L, 2, dst), dst_image(L, dst));
 
-	push_image(L, sbl);
-	
-	return 1;
+	return push_result(L, sbl, dst);
+}
 
+/*
+rgb to hsv and in range in a single pass, only the binary image is made
+*/
+static int lua_hsv_in_range(lua_State* L) {
+	Image** pimg 	= check_image(L, 1);
+	int 	dst 	= dst_index(L, 4);
+
+	value_t on_value 	= opt_arg_integer(L, 4, dst, 255);
+	value_t off_value 	= opt_arg_integer(L, 5, dst, 0);
+
+	value_t lowers[3], uppers[3];
+	if (!get_bounds(L, 2, 3, lowers, uppers))
+		return 0;
+
+	Image* img = hsv_in_range_into(*pimg, opt_hsv_scale(L, 6, dst), lowers, uppers, on_value, off_value,
+		dst_image(L, dst));
+
+	return push_result(L, img, dst);
+}
+
+static int lua_hsv_in_range_mask(lua_State* L) {
+	Image** pimg = check_image(L, 1);
+
+	value_t lowers[3], uppers[3];
+	if (!get_bounds(L, 2, 3, lowers, uppers))
+		return 0;
+
+	return push_mask(L, hsv_in_range_mask(*pimg, opt_hsv_scale(L, 4, 0), lowers, uppers));
+}
+
+/*
+conversions of frames read in a native format, the format is given after the image
+*/
+static int lua_yuv_to_gray(lua_State* L) {
+	Image** pimg 	= check_image(L, 1);
+	int 	dst 	= dst_index(L, 3);
+	Image* 	gray 	= yuv_to_gray_into(*pimg, check_yuv_format(L, 2), dst_image(L, dst));
+
+	return push_result(L, gray, dst);
+}
+
+static int lua_yuv_to_rgb(lua_State* L) {
+	Image** pimg 	= check_image(L, 1);
+	int 	dst 	= dst_index(L, 3);
+	Image* 	rgb 	= yuv_to_rgb_into(*pimg, check_yuv_format(L, 2), dst_image(L, dst));
+
+	return push_result(L, rgb, dst);
+}
+
+static int lua_yuv_to_hsv(lua_State* L) {
+	Image** pimg 	= check_image(L, 1);
+	int 	dst 	= dst_index(L, 3);
+	Image* 	hsv 	= yuv_to_hsv_into(*pimg, check_yuv_format(L, 2), opt_hsv_scale(L, 3, dst), dst_image(L, dst));
+
+	return push_result(L, hsv, dst);
+}
+
+static int lua_yuv_hsv_in_range_mask(lua_State* L) {
+	Image** pimg = check_image(L, 1);
+
+	value_t lowers[3], uppers[3];
+	if (!get_bounds(L, 3, 3, lowers, uppers))
+		return 0;
+
+	return push_mask(L, yuv_hsv_in_range_mask(*pimg, check_yuv_format(L, 2), opt_hsv_scale(L, 5, 0),
+		lowers, uppers));
 }
 
 static int lua_open_device(lua_State* L) {
@@ -127,13 +357,44 @@ static int lua_open_device(lua_State* L) {
 	return 1;
 }
 
+/*
+opens a recording as a device, see make_playback_device
+*/
+static int lua_open_playback(lua_State* L) {
+	const char* path 		= luaL_checkstring(L, 1);
+	char 		realtime 	= lua_toboolean(L, 2);
+	char 		loop 		= lua_toboolean(L, 3);
+	Device* 	dev 		= make_playback_device(path, realtime, loop);
+
+	if (dev == NULL)
+		return 0;
+
+	Device** pdev = (Device**)lua_newuserdata(L, sizeof(Device*));
+
+	*pdev = dev;
+
+	luaL_getmetatable(L, DEVICE_MT);
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+/*
+contours are found on a binary image or a mask,
+the optional steps_x is ignored and steps_y skips rows (see find_contours)
+*/
 static int lua_find_contours(lua_State* L) {
-	Image** pimg 	= (Image**)luaL_checkudata(L, 1, IMAGE_MT);
 	size_t 	steps_x = luaL_optinteger(L, 2, DEFAULT_STEPS_TRACING);
 	size_t 	steps_y = luaL_optinteger(L, 3, DEFAULT_STEPS_TRACING);
 
-	size_t contours_amount;
-	Contour** cnts = find_contours(*pimg, &contours_amount, steps_x, steps_y);
+	size_t 		contours_amount;
+	Contour** 	cnts;
+	Mask** 		pmsk = luaL_testudata(L, 1, MASK_MT);
+
+	if (pmsk)
+		cnts = find_contours_mask(*pmsk, &contours_amount, steps_x, steps_y);
+	else
+		cnts = find_contours(*check_image(L, 1), &contours_amount, steps_x, steps_y);
 
 	lua_createtable(L, contours_amount, 0);
 	for (int i = 0; i < contours_amount; i++){
@@ -151,14 +412,102 @@ static int lua_find_contours(lua_State* L) {
 		lua_settable(L, -3);
 		
 	}
+	free(cnts); // the contours are owned by their userdata
 
 	return 1;
 }
 
+/*
+returns a table of the blobs of a binary image or mask, each with its area (pixel count),
+centroid x, y and bounding box left, top, right, bottom.
+connectivity is 4 (default) or 8, if labels is true a label image is returned too,
+with the index of each pixel's blob and 0 for the background.
+the index is stored little endian over as many channels as it needs,
+one channel up to 255 blobs, two up to 65535 and so on
+*/
+static int lua_find_components(lua_State* L) {
+	lua_Integer connectivity 	= luaL_optinteger(L, 2, 4);
+	int 		want_labels 	= lua_toboolean(L, 3);
+	luaL_argcheck(L, connectivity == 4 || connectivity == 8, 2, "connectivity must be 4 or 8");
+
+	size_t 				amount, width, height;
+	uint32_t* 			labels = NULL;
+	struct component* 	comps;
+	Mask** 				pmsk = luaL_testudata(L, 1, MASK_MT);
+
+	if (pmsk) {
+		width 	= (*pmsk)->width;
+		height 	= (*pmsk)->height;
+		comps 	= find_components_mask(*pmsk, &amount, connectivity == 8, want_labels ? &labels : NULL);
+	}
+	else {
+		Image* img = *check_image(L, 1);
+		width 	= img->width;
+		height 	= img->height;
+		comps 	= find_components(img, &amount, connectivity == 8, want_labels ? &labels : NULL);
+	}
+	if (comps == NULL)
+		return 0;
+
+	lua_createtable(L, amount, 0);
+	for (size_t i = 0; i < amount; i++) {
+		lua_pushinteger(L, i +1); // index of component
+
+		lua_createtable(L, 0, 7);
+		lua_pushinteger(L, comps[i].area);
+		lua_setfield(L, -2, "area");
+		lua_pushnumber(L, comps[i].x +1); // because lua is offset by 1
+		lua_setfield(L, -2, "x");
+		lua_pushnumber(L, comps[i].y +1);
+		lua_setfield(L, -2, "y");
+		lua_pushinteger(L, comps[i].left +1);
+		lua_setfield(L, -2, "left");
+		lua_pushinteger(L, comps[i].top +1);
+		lua_setfield(L, -2, "top");
+		lua_pushinteger(L, comps[i].right +1);
+		lua_setfield(L, -2, "right");
+		lua_pushinteger(L, comps[i].bottom +1);
+		lua_setfield(L, -2, "bottom");
+
+		lua_settable(L, -3);
+	}
+	free(comps);
+
+	if (labels == NULL)
+		return 1;
+
+	size_t channels = 1;
+	while (channels < sizeof(uint32_t) && amount >> (8 * channels))
+		channels++;
+
+	Image* img = make_image(channels, width, height);
+	for (size_t y = 0; y < height; y++) {
+		value_t* 	row 	= IMAGE_ROW(img, y);
+		uint32_t* 	label 	= labels + y * width;
+		for (size_t x = 0; x < width; x++) {
+			for (size_t c = 0; c < channels; c++)
+				row[x * channels + c] = label[x] >> (8 * c);
+		}
+	}
+	free(labels);
+
+	push_image(L, img);
+	return 2;
+}
+
+/*
+pixel maps are written in binary unless "ascii" is given
+*/
 static int lua_write_pixel_map(lua_State* L) {
-	Image** pimg 		= luaL_checkudata(L, 1, IMAGE_MT);
+	const char* const formats[] = {"binary", "ascii", NULL};
+
+	Image** pimg 		= check_image(L, 1);
 	const char* name 	= luaL_checkstring(L, 2);
-	write_pixel_map(name, *pimg);
+
+	if (luaL_checkoption(L, 3, "binary", formats) == 0)
+		write_pixel_map(name, *pimg);
+	else
+		write_pixel_map_ascii(name, *pimg);
 	
 	return 0;
 }
@@ -175,6 +524,80 @@ static int lua_read_pixel_map(lua_State* L) {
 		return 0;
 }
 
+/*
+returns the name of the active kernel backend
+if a name is given that backend is forced instead
+*/
+static int lua_backend(lua_State* L) {
+	if (!lua_isnoneornil(L, 1)) {
+		const char* name = luaL_checkstring(L, 1);
+		if (!kernel_set_backend(name))
+			return luaL_error(L, "backend %s is not supported", name);
+	}
+	lua_pushstring(L, kernel_backend());
+
+	return 1;
+}
+
+/*
+returns the time in ns on the monotonic clock, the clock of the frame times
+*/
+static int lua_now(lua_State* L) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	lua_pushinteger(L, (lua_Integer)ts.tv_sec * 1000000000 + ts.tv_nsec);
+
+	return 1;
+}
+
+/*
+0 threads uses every online cpu, returns the amount of threads in use
+*/
+static int lua_set_threads(lua_State* L) {
+	lua_Integer threads = luaL_checkinteger(L, 1);
+	luaL_argcheck(L, threads >= 0, 1, "threads must not be negative");
+	workers_init(threads);
+	lua_pushinteger(L, workers_count());
+
+	return 1;
+}
+
+/*
+collected with the lua state, the workers must be joined before the module is unloaded
+*/
+static int lua_gc_state(lua_State* L) {
+	workers_shutdown();
+
+	return 0;
+}
+
+static int lua_pool_stats(lua_State* L) {
+	struct pool_stats stats;
+	pool_get_stats(&stats);
+
+	lua_newtable(L);
+	lua_pushinteger(L, stats.hits);
+	lua_setfield(L, -2, "hits");
+	lua_pushinteger(L, stats.misses);
+	lua_setfield(L, -2, "misses");
+	lua_pushinteger(L, stats.buffers);
+	lua_setfield(L, -2, "buffers");
+	lua_pushinteger(L, stats.bytes);
+	lua_setfield(L, -2, "bytes");
+	lua_pushinteger(L, stats.cap);
+	lua_setfield(L, -2, "cap");
+
+	return 1;
+}
+
+static int lua_set_pool_cap(lua_State* L) {
+	lua_Integer bytes = luaL_checkinteger(L, 1);
+	luaL_argcheck(L, bytes >= 0, 1, "cap must not be negative");
+	pool_set_cap(bytes);
+
+	return 0;
+}
+
 //----------------------------------------------------------------------------------------------------
 
 
@@ -182,7 +605,7 @@ static int lua_read_pixel_map(lua_State* L) {
 //----------------------------------------------------------------------------------------------------
 
 static int lua_get_at(lua_State* L) {
-	Image** pimg 	= luaL_checkudata(L, 1, IMAGE_MT);
+	Image** pimg 	= check_image(L, 1);
 	size_t 	c 		= luaL_checkinteger(L, 2) -1;
 	size_t 	x 		= luaL_checkinteger(L, 3) -1;
 	size_t 	y 		= luaL_checkinteger(L, 4) -1;
@@ -194,7 +617,7 @@ static int lua_get_at(lua_State* L) {
 }
 
 static int lua_set_at(lua_State* L) {
-	Image** pimg 	= luaL_checkudata(L, 1, IMAGE_MT);
+	Image** pimg 	= check_image(L, 1);
 	size_t 	c 		= luaL_checkinteger(L, 2) -1;
 	size_t 	x 		= luaL_checkinteger(L, 3) -1;
 	size_t 	y 		= luaL_checkinteger(L, 4) -1;
@@ -207,45 +630,47 @@ static int lua_set_at(lua_State* L) {
 }
 
 static int lua_in_range(lua_State* L) {
-	Image** pimg = luaL_checkudata(L, 1, IMAGE_MT);
+	Image** pimg 	= check_image(L, 1);
+	int 	dst 	= dst_index(L, 4);
 
-	luaL_checktype(L, 2, LUA_TTABLE);
-	luaL_checktype(L, 3, LUA_TTABLE);
+	value_t on_value 	= opt_arg_integer(L, 4, dst, 255);
+	value_t off_value 	= opt_arg_integer(L, 5, dst, 0);
 
-	value_t on_value 	= luaL_optinteger(L, 4, 255);
-	value_t off_value 	= luaL_optinteger(L, 5, 0);
+	// the bounds are kept in a userdata, collected even if get_bounds raises an error
+	size_t 		chnls 	= (*pimg)->channels;
+	value_t* 	lowers 	= lua_newuserdatauv(L, 2 * chnls, 0);
+	value_t* 	uppers 	= lowers + chnls;
 
-	size_t n_lower = luaL_len(L, 2);  // size of lower table
-	size_t n_upper = luaL_len(L, 3);  // size of upper
+	Image* img = NULL;
+	if (get_bounds(L, 2, chnls, lowers, uppers))
+		img = in_range_into(*pimg, lowers, uppers, on_value, off_value, dst_image(L, dst));
 
-	if (n_lower == n_upper && n_lower == (*pimg)->channels) {
-		value_t* lowers = calloc(n_lower, sizeof(value_t));
-		value_t* uppers = calloc(n_upper, sizeof(value_t));
+	return push_result(L, img, dst);
+}
 
-		if (lowers == NULL || uppers == NULL)
-			return luaL_error(L, "memory error");
+static int lua_in_range_mask(lua_State* L) {
+	Image** pimg 	= check_image(L, 1);
+	size_t 	chnls 	= (*pimg)->channels;
 
-		for (int i = 1; i <= n_lower; i++) {
-			// tables are at 2 and 3 pushing index to get value
-			get_index_integer(L, 2, i);
-			lowers[i-1] = lua_tointeger(L, -1);
+	// the bounds are kept in a userdata, collected even if get_bounds raises an error
+	value_t* lowers = lua_newuserdatauv(L, 2 * chnls, 0);
+	value_t* uppers = lowers + chnls;
 
-			get_index_integer(L, 3, i);
-			uppers[i-1] = lua_tointeger(L, -1);
+	Mask* msk = NULL;
+	if (get_bounds(L, 2, chnls, lowers, uppers))
+		msk = in_range_mask(*pimg, lowers, uppers);
 
-		}
-		Image* img = in_range(*pimg, lowers, uppers, on_value, off_value);
-		push_image(L, img);
-	
-		return 1;
-	
-	}
-	else
-		return 0;
+	return push_mask(L, msk);
+}
+
+static int lua_image_to_mask(lua_State* L) {
+	Image** pimg = check_image(L, 1);
+
+	return push_mask(L, image_to_mask(*pimg));
 }
 
 static int lua_image_shape(lua_State* L) {
-	Image** pimg = luaL_checkudata(L, 1, IMAGE_MT);
+	Image** pimg = check_image(L, 1);
 	lua_pushinteger(L, (*pimg)->channels);
 	lua_pushinteger(L, (*pimg)->width);
 	lua_pushinteger(L, (*pimg)->height);
@@ -254,21 +679,47 @@ static int lua_image_shape(lua_State* L) {
 }
 
 static int lua_image_invert(lua_State* L) {
-	Image** pimg 	= luaL_checkudata(L, 1, IMAGE_MT);
-	Image* 	invert 	= invert_image(*pimg);
+	Image** pimg 	= check_image(L, 1);
+	int 	dst 	= dst_index(L, 2);
+	Image* 	invert 	= invert_image_into(*pimg, dst_image(L, dst));
 
-	push_image(L, invert);
+	return push_result(L, invert, dst);
+}
 
-	return 1;
+static int lua_apply_lut(lua_State* L) {
+	Image** pimg 	= check_image(L, 1);
+	int 	dst 	= dst_index(L, 3);
+
+	value_t lut[MAX_VALUE +1];
+	get_lut(L, 2, lut);
+
+	return push_result(L, apply_lut_into(*pimg, lut, dst_image(L, dst)), dst);
+}
+
+/*
+x and y start at 1 like getat
+*/
+static int lua_image_view(lua_State* L) {
+	Image** pimg 	= check_image(L, 1);
+	size_t 	x 		= luaL_checkinteger(L, 2) -1;
+	size_t 	y 		= luaL_checkinteger(L, 3) -1;
+	size_t 	w 		= luaL_checkinteger(L, 4);
+	size_t 	h 		= luaL_checkinteger(L, 5);
+
+	Image* view = make_view(*pimg, x, y, w, h);
+	if (view == NULL)
+		return luaL_error(L, "view out of image bounds");
+
+	return push_image(L, view);
 }
 
 static int lua_split_channel(lua_State* L) {
-	Image** pimg 	= luaL_checkudata(L, 1, IMAGE_MT);
+	Image** pimg 	= check_image(L, 1);
 	size_t 	i 		= luaL_checkinteger(L, 2) -1;
+	int 	dst 	= dst_index(L, 3);
 	
 	if (i < (*pimg)->channels) {
-		push_image(L, split_channel(*pimg, i));
-		return 1;
+		return push_result(L, split_channel_into(*pimg, i, dst_image(L, dst)), dst);
 	}
 	else {
 		luaL_error(L, "invalid channel given");
@@ -278,88 +729,79 @@ static int lua_split_channel(lua_State* L) {
 }
 
 static int lua_add_image(lua_State* L) {
-	Image** pimg 	= luaL_checkudata(L, 1, IMAGE_MT);
+	Image** pimg 	= check_image(L, 1);
 	float 	x 		= luaL_checknumber(L, 2);
+	int 	dst 	= dst_index(L, 3);
 
-	push_image(L, image_add(*pimg, x));
-	
-	return 1;
+	return push_result(L, image_add_into(*pimg, x, dst_image(L, dst)), dst);
 }
 
 static int lua_sub_image(lua_State* L) {
-	Image** pimg 	= luaL_checkudata(L, 1, IMAGE_MT);
+	Image** pimg 	= check_image(L, 1);
 	float 	x 		= luaL_checknumber(L, 2);
+	int 	dst 	= dst_index(L, 3);
 
-	push_image(L, image_sub(*pimg, x));
-	
-	return 1;
+	return push_result(L, image_sub_into(*pimg, x, dst_image(L, dst)), dst);
 }
 
 static int lua_mul_image(lua_State* L) {
-	Image** pimg 	= luaL_checkudata(L, 1, IMAGE_MT);
+	Image** pimg 	= check_image(L, 1);
 	float 	x 		= luaL_checknumber(L, 2);
+	int 	dst 	= dst_index(L, 3);
 
-	push_image(L, image_mul(*pimg, x));
-
-	return 1;
+	return push_result(L, image_mul_into(*pimg, x, dst_image(L, dst)), dst);
 }
 
 static int lua_div_image(lua_State* L) {
-	Image** pimg 	= luaL_checkudata(L, 1, IMAGE_MT);
+	Image** pimg 	= check_image(L, 1);
 	float 	x 		= luaL_checknumber(L, 2);
+	int 	dst 	= dst_index(L, 3);
 
-	push_image(L, image_div(*pimg, x));
-
-	return 1;
+	return push_result(L, image_div_into(*pimg, x, dst_image(L, dst)), dst);
 }
 
 static int lua_not_image(lua_State* L) {
-	Image** pimg 	= luaL_checkudata(L, 1, IMAGE_MT);
+	Image** pimg 	= check_image(L, 1);
+	int 	dst 	= dst_index(L, 2);
 
-	push_image(L, image_not(*pimg));
-
-	return 1;
+	return push_result(L, image_not_into(*pimg, dst_image(L, dst)), dst);
 }
 
 static int lua_and_image(lua_State* L) {
-	Image** pimg1 = luaL_checkudata(L, 1, IMAGE_MT);
-	Image** pimg2 = luaL_checkudata(L, 2, IMAGE_MT);
+	Image** pimg1 	= check_image(L, 1);
+	Image** pimg2 	= check_image(L, 2);
+	int 	dst 	= dst_index(L, 3);
 
-	push_image(L, image_and(*pimg1, *pimg2));
-
-	return 1;
+	return push_result(L, image_and_into(*pimg1, *pimg2, dst_image(L, dst)), dst);
 }
 
 static int lua_or_image(lua_State* L) {
-	Image** pimg1 = luaL_checkudata(L, 1, IMAGE_MT);
-	Image** pimg2 = luaL_checkudata(L, 2, IMAGE_MT);
-
-	push_image(L, image_or(*pimg1, *pimg2));
+	Image** pimg1 	= check_image(L, 1);
+	Image** pimg2 	= check_image(L, 2);
+	int 	dst 	= dst_index(L, 3);
 
-	return 1;
+	return push_result(L, image_or_into(*pimg1, *pimg2, dst_image(L, dst)), dst);
 }
 
 static int lua_xor_image(lua_State* L) {
-	Image** pimg1 = luaL_checkudata(L, 1, IMAGE_MT);
-	Image** pimg2 = luaL_checkudata(L, 2, IMAGE_MT);
-
-	push_image(L, image_xor(*pimg1, *pimg2));
+	Image** pimg1 	= check_image(L, 1);
+	Image** pimg2 	= check_image(L, 2);
+	int 	dst 	= dst_index(L, 3);
 
-	return 1;
+	return push_result(L, image_xor_into(*pimg1, *pimg2, dst_image(L, dst)), dst);
 }
 
 static int lua_concat_image(lua_State* L) {
-	Image** pimg1 = luaL_checkudata(L, 1, IMAGE_MT);
-	Image** pimg2 = luaL_checkudata(L, 2, IMAGE_MT);
-	
-	push_image(L, concat_channels(*pimg1, *pimg2));
+	Image** pimg1 	= check_image(L, 1);
+	Image** pimg2 	= check_image(L, 2);
+	int 	dst 	= dst_index(L, 3);
 
-	return 1;
+	return push_result(L, concat_channels_into(*pimg1, *pimg2, dst_image(L, dst)), dst);
 }
 
 static int lua_eq_image(lua_State* L) {
-	Image** pimg1 = luaL_checkudata(L, 1, IMAGE_MT);
-	Image** pimg2 = luaL_checkudata(L, 2, IMAGE_MT);
+	Image** pimg1 = check_image(L, 1);
+	Image** pimg2 = check_image(L, 2);
 
 	char result = image_equality(*pimg1, *pimg2);
 	lua_pushboolean(L, result);
@@ -367,40 +809,361 @@ static int lua_eq_image(lua_State* L) {
 	return 1;
 }
 
+/*
+returns the capture time, the time the frame was read (both in ns, see kestrel.now)
+and the sequence number of a device frame
+*/
+static int lua_image_frame_info(lua_State* L) {
+	Image** pimg = check_image(L, 1);
+	lua_pushinteger(L, (*pimg)->timestamp);
+	lua_pushinteger(L, (*pimg)->dequeued);
+	lua_pushinteger(L, (*pimg)->sequence);
+	return 3;
+}
+
+/*
+frees the image now instead of waiting for the garbage collector,
+a leased camera frame gives its buffer back to the driver
+*/
+static int lua_release_image(lua_State* L) {
+	Image** pimg = check_image(L, 1);
+	free_image(*pimg);
+	*pimg = NULL;
+
+	return 0;
+}
+
 static int lua_gc_image(lua_State* L) {
 	Image** pimg = (Image**)luaL_checkudata(L, 1, IMAGE_MT);
-	free_image(*pimg);
+	if (*pimg)
+		free_image(*pimg);
 
 	return 0;
 }
 
 //----------------------------------------------------------------------------------------------------
 
-// DEVICE
+// MASK
 //----------------------------------------------------------------------------------------------------
 
-static int lua_read_frame(lua_State* L) {
-	Device** pdev 	= (Device**)luaL_checkudata(L, 1, DEVICE_MT);
-	Image** pimg 	= (Image**)lua_newuserdata(L, sizeof(Image*));
+static int lua_mask_get_at(lua_State* L) {
+	Mask** 	pmsk 	= luaL_checkudata(L, 1, MASK_MT);
+	size_t 	x 		= luaL_checkinteger(L, 2) -1;
+	size_t 	y 		= luaL_checkinteger(L, 3) -1;
 
-	*pimg = read_frame(*pdev);
+	lua_pushboolean(L, mask_get(*pmsk, x, y));
 
-	luaL_getmetatable(L, IMAGE_MT);
-	lua_setmetatable(L, -2);
+	return 1;
+}
+
+static int lua_mask_set_at(lua_State* L) {
+	Mask** 	pmsk 	= luaL_checkudata(L, 1, MASK_MT);
+	size_t 	x 		= luaL_checkinteger(L, 2) -1;
+	size_t 	y 		= luaL_checkinteger(L, 3) -1;
+
+	mask_set(*pmsk, x, y, lua_toboolean(L, 4));
+
+	return 0;
+}
+
+static int lua_mask_shape(lua_State* L) {
+	Mask** pmsk = luaL_checkudata(L, 1, MASK_MT);
+	lua_pushinteger(L, (*pmsk)->width);
+	lua_pushinteger(L, (*pmsk)->height);
+
+	return 2;
+}
+
+static int lua_mask_count(lua_State* L) {
+	Mask** pmsk = luaL_checkudata(L, 1, MASK_MT);
+	lua_pushinteger(L, mask_count(*pmsk));
+
+	return 1;
+}
+
+static int lua_mask_to_image(lua_State* L) {
+	Mask** 	pmsk 		= luaL_checkudata(L, 1, MASK_MT);
+	value_t on_value 	= luaL_optinteger(L, 2, 255);
+	value_t off_value 	= luaL_optinteger(L, 3, 0);
+
+	return push_image(L, mask_to_image(*pmsk, on_value, off_value));
+}
+
+static int lua_not_mask(lua_State* L) {
+	Mask** pmsk = luaL_checkudata(L, 1, MASK_MT);
+
+	return push_mask(L, mask_not(*pmsk));
+}
+
+static int lua_and_mask(lua_State* L) {
+	Mask** pmsk1 = luaL_checkudata(L, 1, MASK_MT);
+	Mask** pmsk2 = luaL_checkudata(L, 2, MASK_MT);
+
+	return push_mask(L, mask_and(*pmsk1, *pmsk2));
+}
+
+static int lua_or_mask(lua_State* L) {
+	Mask** pmsk1 = luaL_checkudata(L, 1, MASK_MT);
+	Mask** pmsk2 = luaL_checkudata(L, 2, MASK_MT);
+
+	return push_mask(L, mask_or(*pmsk1, *pmsk2));
+}
+
+static int lua_xor_mask(lua_State* L) {
+	Mask** pmsk1 = luaL_checkudata(L, 1, MASK_MT);
+	Mask** pmsk2 = luaL_checkudata(L, 2, MASK_MT);
+
+	return push_mask(L, mask_xor(*pmsk1, *pmsk2));
+}
+
+static int lua_eq_mask(lua_State* L) {
+	Mask** pmsk1 = luaL_checkudata(L, 1, MASK_MT);
+	Mask** pmsk2 = luaL_checkudata(L, 2, MASK_MT);
+
+	lua_pushboolean(L, mask_equality(*pmsk1, *pmsk2));
 
 	return 1;
 }
 
+static int lua_gc_mask(lua_State* L) {
+	Mask** pmsk = luaL_checkudata(L, 1, MASK_MT);
+	free_mask(*pmsk);
+
+	return 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+
+// DEVICE
+//----------------------------------------------------------------------------------------------------
+
+/*
+like luaL_checkudata but raises an error for closed devices
+*/
+static Device** check_device(lua_State* L, int index) {
+	Device** pdev = luaL_checkudata(L, index, DEVICE_MT);
+	if (*pdev == NULL)
+		luaL_error(L, "device was closed");
+	return pdev;
+}
+
+/*
+returns nil when no frame can be read, at the end of a recording for example
+*/
+static int lua_read_frame(lua_State* L) {
+	Device** pdev 	= check_device(L, 1);
+	Image* 	 img 	= read_frame(*pdev);
+
+	if (img == NULL)
+		return 0;
+
+	return push_image(L, img);
+}
+
 static int lua_device_resolution(lua_State* L) {
-	Device** pdev = (Device**)luaL_checkudata(L, 1, DEVICE_MT);
-	lua_pushinteger(L, (*pdev)->fmt->fmt.pix.width);
-	lua_pushinteger(L, (*pdev)->fmt->fmt.pix.height);
+	Device** pdev = check_device(L, 1);
+	lua_pushinteger(L, (*pdev)->width);
+	lua_pushinteger(L, (*pdev)->height);
 	return 2;
 }
 
+/*
+records every frame read into the file given, without a file the recording is stopped
+*/
+static int lua_device_record(lua_State* L) {
+	Device** 	pdev = check_device(L, 1);
+	const char* file = luaL_optstring(L, 2, NULL);
+
+	lua_pushboolean(L, record_device(*pdev, file));
+	return 1;
+}
+
+/*
+returns the frames written and dropped by the current recording and whether a write failed
+*/
+static int lua_device_record_stats(lua_State* L) {
+	Device** pdev = check_device(L, 1);
+
+	if ((*pdev)->recorder == NULL)
+		return 0;
+
+	size_t 	written, dropped;
+	char 	failed;
+	recorder_stats((*pdev)->recorder, &written, &dropped, &failed);
+	lua_pushinteger(L, written);
+	lua_pushinteger(L, dropped);
+	lua_pushboolean(L, failed);
+	return 3;
+}
+
+/*
+returns a table of the frame counters, see device_stats
+*/
+static int lua_device_stats(lua_State* L) {
+	Device** pdev = check_device(L, 1);
+	struct device_stats stats;
+	device_stats(*pdev, &stats);
+
+	lua_createtable(L, 0, 8);
+	put_integer_in_table(L, "delivered", stats.delivered);
+	put_integer_in_table(L, "skipped", stats.skipped);
+	put_integer_in_table(L, "dropped", stats.dropped);
+	put_integer_in_table(L, "gaps", stats.gaps);
+	put_number_in_table(L, "meaninterval", stats.mean_interval / 1e6); // milliseconds
+	put_number_in_table(L, "p99interval", stats.p99_interval / 1e6);
+	put_number_in_table(L, "selecttime", stats.select_time / 1e6);
+	put_integer_in_table(L, "corrupt", stats.corrupt);
+	return 1;
+}
+
+/*
+returns the pixel format of a camera, nil for other devices
+*/
+static int lua_device_format(lua_State* L) {
+	Device** 	pdev 	= check_device(L, 1);
+	const char* format 	= device_format(*pdev);
+
+	if (format == NULL)
+		return 0;
+
+	lua_pushstring(L, format);
+	return 1;
+}
+
+/*
+in lease mode frames are views on the camera buffers, see device_lease_mode
+*/
+static int lua_device_lease_mode(lua_State* L) {
+	Device** pdev = check_device(L, 1);
+
+	device_lease_mode(*pdev, lua_toboolean(L, 2));
+	return 0;
+}
+
+/*
+a closed device raises errors when used, in a capture group too.
+devices are closed when collected so their capture and writer threads are stopped
+*/
 static int lua_close_device(lua_State* L) {
 	Device** pdev = (Device**)luaL_checkudata(L, 1, DEVICE_MT);
-	free_device(*pdev);
+	if (*pdev)
+		free_device(*pdev);
+	*pdev = NULL;
+
+	return 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+
+// CAPTURE GROUP
+//----------------------------------------------------------------------------------------------------
+
+/*
+groups a table of cameras, window is the largest time difference in ms
+between the frames of a set. the group keeps the cameras from being collected,
+reading it raises an error once one of them was closed
+*/
+static int lua_open_group(lua_State* L) {
+	luaL_checktype(L, 1, LUA_TTABLE);
+	float 	window 	= luaL_checknumber(L, 2);
+	size_t 	count 	= luaL_len(L, 1);
+	Device* devices[count +1];
+
+	for (size_t i = 0; i < count; i++) {
+		get_index_integer(L, 1, i +1);
+		devices[i] = *check_device(L, -1);
+		lua_pop(L, 1);
+	}
+
+	CaptureGroup* grp = make_group(devices, count, window * 1e6);
+	if (grp == NULL)
+		return 0;
+
+	// the devices are the user values of the group
+	CaptureGroup** pgrp = (CaptureGroup**)lua_newuserdatauv(L, sizeof(CaptureGroup*), count);
+
+	*pgrp = grp;
+
+	for (size_t i = 0; i < count; i++) {
+		get_index_integer(L, 1, i +1);
+		lua_setiuservalue(L, -2, i +1);
+	}
+
+	luaL_getmetatable(L, GROUP_MT);
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+static CaptureGroup* check_group(lua_State* L, int index) {
+	CaptureGroup** pgrp = luaL_checkudata(L, index, GROUP_MT);
+	if (*pgrp == NULL)
+		luaL_error(L, "capture group was closed");
+	return *pgrp;
+}
+
+/*
+returns a frame of every camera in the order they were grouped, nothing on timeout
+*/
+static int lua_read_group(lua_State* L) {
+	CaptureGroup* 	grp = check_group(L, 1);
+	Image* 			frames[grp->count +1];
+
+	for (size_t i = 0; i < grp->count; i++) {
+		lua_getiuservalue(L, 1, i +1);
+		Device* dev = *(Device**)lua_touserdata(L, -1);
+		lua_pop(L, 1);
+		if (dev == NULL)
+			return luaL_error(L, "device %d of the capture group was closed", (int)i +1);
+	}
+
+	if (!read_group(grp, frames))
+		return 0;
+
+	luaL_checkstack(L, grp->count, NULL);
+	for (size_t i = 0; i < grp->count; i++)
+		push_image(L, frames[i]);
+
+	return grp->count;
+}
+
+/*
+returns the sets matched, the frames discarded and the skew of every camera
+to the first camera, as a table of mean and max in ms
+*/
+static int lua_group_stats(lua_State* L) {
+	CaptureGroup* 		grp = check_group(L, 1);
+	struct group_stats 	stats;
+	group_stats(grp, &stats);
+
+	lua_createtable(L, 0, 3);
+	put_integer_in_table(L, "sets", stats.sets);
+	put_integer_in_table(L, "discarded", stats.discarded);
+
+	lua_createtable(L, grp->count, 0);
+	for (size_t i = 0; i < grp->count; i++) {
+		int64_t 	mean;
+		uint64_t 	max;
+		group_skew(grp, i, &mean, &max);
+
+		lua_pushinteger(L, i +1);
+
+		lua_createtable(L, 0, 2);
+		put_number_in_table(L, "mean", mean / 1e6);
+		put_number_in_table(L, "max", max / 1e6);
+
+		lua_settable(L, -3);
+	}
+	lua_setfield(L, -2, "skew");
+
+	return 1;
+}
+
+static int lua_close_group(lua_State* L) {
+	CaptureGroup** pgrp = (CaptureGroup**)luaL_checkudata(L, 1, GROUP_MT);
+	if (*pgrp)
+		free_group(*pgrp);
+	*pgrp = NULL;
 
 	return 0;
 }
@@ -426,16 +1189,25 @@ static int lua_contour_center(lua_State* L) {
 static int lua_contour_to_table(lua_State* L) {
 	Contour** pcnt = (Contour**)luaL_checkudata(L, 1, CONTOUR_MT);
 
-	lua_createtable(L, (*pcnt)->index, 1);
-	for (int i = 0; i < (*pcnt)->index; i++) {
+	Contour* 		cnt = *pcnt;
+	struct point 	p 	= cnt->start; // the chain is decoded on the way
+
+	lua_createtable(L, cnt->index, 1);
+	for (size_t i = 0; i < cnt->index; i++) {
 		lua_pushinteger(L, i+1); // index
 
 		lua_createtable(L, 2, 0);
-		put_integer_in_table(L, "x", (*pcnt)->points[i].x +1);
+		put_integer_in_table(L, "x", p.x +1);
 
-		put_integer_in_table(L, "y", (*pcnt)->points[i].y +1);
+		put_integer_in_table(L, "y", p.y +1);
 		
 		lua_settable(L, -3);
+
+		if (i +1 < cnt->index) {
+			int step = CHAIN_STEP(cnt, i);
+			p.x += CHAIN_DX(step);
+			p.y += CHAIN_DY(step);
+		}
 	}
 
 	return 1;
@@ -491,6 +1263,57 @@ static int lua_contour_fit_line(lua_State* L) {
 
 }
 
+/*
+raw moments are in lua coordinates (offset by 1), central moments don't depend on them
+*/
+static int lua_contour_moments(lua_State* L) {
+	Contour** pcnt = (Contour**)luaL_checkudata(L, 1, CONTOUR_MT);
+	struct moments m;
+	contour_moments(*pcnt, &m);
+
+	const char* names[] = {"m00", "m10", "m01", "m20", "m11", "m02",
+		"mu20", "mu11", "mu02", "mu30", "mu21", "mu12", "mu03"};
+	double values[] = {
+		m.m00,
+		m.m10 + m.m00,
+		m.m01 + m.m00,
+		m.m20 + 2 * m.m10 + m.m00,
+		m.m11 + m.m10 + m.m01 + m.m00,
+		m.m02 + 2 * m.m01 + m.m00,
+		m.mu20, m.mu11, m.mu02, m.mu30, m.mu21, m.mu12, m.mu03
+	};
+
+	lua_createtable(L, 0, 13);
+	for (int i = 0; i < 13; i++) {
+		lua_pushnumber(L, values[i]);
+		lua_setfield(L, -2, names[i]);
+	}
+
+	return 1;
+}
+
+static int lua_contour_orientation(lua_State* L) {
+	Contour** pcnt = (Contour**)luaL_checkudata(L, 1, CONTOUR_MT);
+	lua_pushnumber(L, contour_orientation(*pcnt));
+
+	return 1;
+}
+
+static int lua_contour_hu_moments(lua_State* L) {
+	Contour** pcnt = (Contour**)luaL_checkudata(L, 1, CONTOUR_MT);
+	double hu[7];
+	contour_hu_moments(*pcnt, hu);
+
+	lua_createtable(L, 7, 0);
+	for (int i = 0; i < 7; i++) {
+		lua_pushinteger(L, i +1); // index
+		lua_pushnumber(L, hu[i]);
+		lua_settable(L, -3);
+	}
+
+	return 1;
+}
+
 static int lua_gc_contour(lua_State* L) {
 	Contour** pcnt = (Contour**)luaL_checkudata(L, 1, CONTOUR_MT);
 	free_contour(*pcnt);
@@ -509,21 +1332,54 @@ int LUA_API luaopen_kestrel(lua_State* L) {
 		{"rgb_to_hsv", 			lua_rgb_to_hsv},
 		{"grayscale", 			lua_grayscale},
 		{"sobel", 				lua_sobel},
+		{"hsv_inrange", 		lua_hsv_in_range},
+		{"hsv_inrangemask", 	lua_hsv_in_range_mask},
+		{"apply_lut", 			lua_apply_lut},
+		{"yuv_to_gray", 		lua_yuv_to_gray},
+		{"yuv_to_rgb", 			lua_yuv_to_rgb},
+		{"yuv_to_hsv", 			lua_yuv_to_hsv},
+		{"yuv_hsv_inrangemask", lua_yuv_hsv_in_range_mask},
 		{"opendevice",			lua_open_device},
+		{"openplayback",		lua_open_playback},
+		{"opengroup",			lua_open_group},
 		{"findcontours",		lua_find_contours},
+		{"components",			lua_find_components},
 		{"write_pixelmap", 		lua_write_pixel_map},
 		{"read_pixelmap",		lua_read_pixel_map},
+		{"backend",				lua_backend},
+		{"set_threads",			lua_set_threads},
+		{"poolstats",			lua_pool_stats},
+		{"setpoolcap",			lua_set_pool_cap},
+		{"now",					lua_now},
 		{NULL, NULL},
 	};
 
+	kernel_init();
+	workers_init(0);
+
 	if (luaL_newmetatable(L, IMAGE_MT)) {
 		const luaL_Reg image_funcs[] = {
 				{"getat", 				lua_get_at},
 				{"setat", 				lua_set_at},
 				{"inrange", 			lua_in_range},
+				{"inrangemask", 		lua_in_range_mask},
+				{"tomask", 				lua_image_to_mask},
 				{"shape", 				lua_image_shape},
 				{"invert", 				lua_image_invert},
 				{"splitchannel", 		lua_split_channel},
+				{"lut", 				lua_apply_lut},
+				{"view", 				lua_image_view},
+				{"release", 			lua_release_image},
+				{"frameinfo", 			lua_image_frame_info},
+				{"add", 				lua_add_image},
+				{"sub", 				lua_sub_image},
+				{"mul", 				lua_mul_image},
+				{"div", 				lua_div_image},
+				{"bnot", 				lua_not_image},
+				{"band", 				lua_and_image},
+				{"bor", 				lua_or_image},
+				{"bxor", 				lua_xor_image},
+				{"concat", 				lua_concat_image},
 				{"__add", 				lua_add_image},
 				{"__sub", 				lua_sub_image},
 				{"__mul", 				lua_mul_image},
@@ -543,12 +1399,44 @@ int LUA_API luaopen_kestrel(lua_State* L) {
 	}
 
 	lua_pop(L, 1); // discard metatable
+
+	if (luaL_newmetatable(L, MASK_MT)) {
+		const luaL_Reg mask_funcs[] = {
+				{"getat", 		lua_mask_get_at},
+				{"setat", 		lua_mask_set_at},
+				{"shape", 		lua_mask_shape},
+				{"count", 		lua_mask_count},
+				{"toimage", 	lua_mask_to_image},
+				{"bnot", 		lua_not_mask},
+				{"band", 		lua_and_mask},
+				{"bor", 		lua_or_mask},
+				{"bxor", 		lua_xor_mask},
+				{"__bnot", 		lua_not_mask},
+				{"__band", 		lua_and_mask},
+				{"__bor", 		lua_or_mask},
+				{"__bxor", 		lua_xor_mask},
+				{"__eq", 		lua_eq_mask},
+				{"__gc", 		lua_gc_mask},
+				{NULL, NULL},
+			};
+		luaL_setfuncs(L, mask_funcs, 0);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -2, "__index");
+	}
+
+	lua_pop(L, 1);
 	
 	if (luaL_newmetatable(L, DEVICE_MT)) {
 		const luaL_Reg device_funcs[] = {
 				{"readframe", 	lua_read_frame},
 				{"resolution", 	lua_device_resolution},
+				{"record", 		lua_device_record},
+				{"recordstats", lua_device_record_stats},
+				{"leasemode", 	lua_device_lease_mode},
+				{"stats", 		lua_device_stats},
+				{"format", 		lua_device_format},
 				{"close", 		lua_close_device},
+				{"__gc", 		lua_close_device},
 				{NULL, NULL},
 			};
 		luaL_setfuncs(L, device_funcs, 0);
@@ -558,6 +1446,21 @@ int LUA_API luaopen_kestrel(lua_State* L) {
 
 	lua_pop(L, 1);
 
+	if (luaL_newmetatable(L, GROUP_MT)) {
+		const luaL_Reg group_funcs[] = {
+				{"read", 		lua_read_group},
+				{"stats", 		lua_group_stats},
+				{"close", 		lua_close_group},
+				{"__gc", 		lua_close_group},
+				{NULL, NULL},
+			};
+		luaL_setfuncs(L, group_funcs, 0);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -2, "__index");
+	}
+
+	lua_pop(L, 1);
+
 	if (luaL_newmetatable(L, CONTOUR_MT)) {
 		const luaL_Reg contour_funcs[] = {
 				{"center",		lua_contour_center},
@@ -566,6 +1469,9 @@ int LUA_API luaopen_kestrel(lua_State* L) {
 				{"perimeter",	lua_contour_perimeter},
 				{"area",		lua_contour_area},
 				{"fitline",		lua_contour_fit_line},
+				{"moments",		lua_contour_moments},
+				{"orientation",	lua_contour_orientation},
+				{"hu",			lua_contour_hu_moments},
 				{"__gc",		lua_gc_contour},
 				{NULL, NULL},
 			};
@@ -576,6 +1482,15 @@ int LUA_API luaopen_kestrel(lua_State* L) {
 
 	lua_pop(L, 1); 
 
+	// the sentinel lives in the registry so it is only collected by lua_close
+	lua_newuserdatauv(L, 0, 0);
+	if (luaL_newmetatable(L, STATE_MT)) {
+		lua_pushcfunction(L, lua_gc_state);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+	lua_setfield(L, LUA_REGISTRYINDEX, STATE_MT);
+
 	lua_createtable(L, sizeof(lib) / sizeof(lib[0]), 0);
 	luaL_setfuncs(L, lib, 0);
 
@@ -0,0 +1,277 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mask.h"
+#include "kernel.h"
+#include "workers.h"
+
+#define MAX(MAX_A,MAX_B) (((MAX_A)>(MAX_B))?(MAX_A):(MAX_B))
+
+// HELPERS
+//----------------------------------------------------------------------------------------------------
+
+/*
+arguments of a mask function, shared by the bands running it
+*/
+struct job {
+	Image* 			img;
+	Mask* 			result;
+	value_t* 		lower;
+	value_t* 		upper;
+	enum hsv_scale 	scale;
+};
+
+/*
+the bytes of a row are made by the image kernels and packed into bits
+*/
+static value_t* row_buffer(size_t width) {
+	value_t* row = malloc(width * sizeof(value_t));
+	if (row == NULL) {
+		fprintf(stderr, "Cannot allocate mask\n");
+		exit(EXIT_FAILURE);
+	}
+	return row;
+}
+
+static void pack_band(void* ctx, size_t y0, size_t y1) {
+	struct job* job = ctx;
+	for (size_t i = y0; i < y1; i++)
+		kernel_pack_mask(IMAGE_ROW(job->img, i), MASK_ROW(job->result, i), job->img->width);
+}
+
+static void in_range_band(void* ctx, size_t y0, size_t y1) {
+	struct job* job = ctx;
+	value_t* 	row = row_buffer(job->img->width);
+
+	for (size_t i = y0; i < y1; i++) {
+		kernel_in_range(IMAGE_ROW(job->img, i), row, job->img->width, job->img->channels,
+			job->lower, job->upper, 1, 0);
+		kernel_pack_mask(row, MASK_ROW(job->result, i), job->img->width);
+	}
+	free(row);
+}
+
+static void hsv_in_range_band(void* ctx, size_t y0, size_t y1) {
+	struct job* job = ctx;
+	value_t* 	row = row_buffer(job->img->width);
+
+	for (size_t i = y0; i < y1; i++) {
+		kernel_hsv_in_range(IMAGE_ROW(job->img, i), row, job->img->width, job->scale,
+			job->lower, job->upper, 1, 0);
+		kernel_pack_mask(row, MASK_ROW(job->result, i), job->img->width);
+	}
+	free(row);
+}
+
+/*
+word k of row y, masks are padded with zeros past their size
+*/
+static inline uint64_t padded_word(Mask* msk, size_t k, size_t y) {
+	return y < msk->height && k < msk->stride ? MASK_ROW(msk, y)[k] : 0;
+}
+
+static uint64_t and(uint64_t a, uint64_t b) {
+	return a & b;
+}
+
+static uint64_t or(uint64_t a, uint64_t b) {
+	return a | b;
+}
+
+static uint64_t xor(uint64_t a, uint64_t b) {
+	return a ^ b;
+}
+
+/*
+masks of different sizes are padded with zeros to the larger size,
+none of the operations can set the bits past the width
+*/
+static Mask* logic_operation(Mask* msk1, Mask* msk2, uint64_t (*fn)(uint64_t a, uint64_t b)) {
+	Mask* result = make_mask(MAX(msk1->width, msk2->width), MAX(msk1->height, msk2->height));
+
+	for (size_t i = 0; i < result->height; i++) {
+		uint64_t* row = MASK_ROW(result, i);
+		for (size_t k = 0; k < result->stride; k++)
+			row[k] = (*fn)(padded_word(msk1, k, i), padded_word(msk2, k, i));
+	}
+	return result;
+}
+
+//----------------------------------------------------------------------------------------------------
+
+// COMMON FUNCTIONS
+//----------------------------------------------------------------------------------------------------
+
+Mask* make_mask(size_t width, size_t height) {
+	size_t 		stride 	= MASK_WORDS(width);
+	uint64_t* 	data 	= calloc(stride * height, sizeof(uint64_t));
+	Mask* 		msk 	= malloc(sizeof(Mask));
+
+	if ((data || stride * height == 0) && msk) {
+		msk->width 	= width;
+		msk->height = height;
+		msk->stride = stride;
+		msk->data 	= data;
+		return msk;
+	}
+	else {
+		fprintf(stderr, "Cannot allocate mask\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void free_mask(Mask* msk) {
+	free(msk->data);
+	free(msk);
+}
+
+/*
+like get_at, out of range pixels are 0
+*/
+char mask_get(Mask* msk, size_t x, size_t y) {
+	if (x < msk->width && y < msk->height)
+		return MASK_BIT(msk, x, y);
+	else
+		return 0;
+}
+
+void mask_set(Mask* msk, size_t x, size_t y, char value) {
+	if (x < msk->width && y < msk->height) {
+		uint64_t bit = (uint64_t)1 << (x % 64);
+		if (value)
+			MASK_ROW(msk, y)[x / 64] |= bit;
+		else
+			MASK_ROW(msk, y)[x / 64] &= ~bit;
+	}
+}
+
+/*
+amount of set pixels
+*/
+size_t mask_count(Mask* msk) {
+	size_t count = 0;
+	for (size_t i = 0; i < msk->height; i++) {
+		uint64_t* row = MASK_ROW(msk, i);
+		for (size_t k = 0; k < msk->stride; k++)
+			count += __builtin_popcountll(row[k]);
+	}
+	return count;
+}
+
+/*
+every non zero pixel of a one channel image is set
+*/
+Mask* image_to_mask(Image* img) {
+	if (img->channels == 1) {
+		Mask* result = make_mask(img->width, img->height);
+
+		struct job job = {.img = img, .result = result};
+		workers_run(pack_band, &job, img->width, img->height);
+
+		return result;
+	}
+	else {
+		fprintf(stderr, "Mask from one channel images only\n");
+		return NULL;
+	}
+}
+
+Image* mask_to_image(Mask* msk, value_t on, value_t off) {
+	Image* result = make_image(1, msk->width, msk->height);
+
+	for (size_t i = 0; i < msk->height; i++)
+		kernel_unpack_mask(MASK_ROW(msk, i), IMAGE_ROW(result, i), msk->width, on, off);
+
+	return result;
+}
+
+/*
+same as in_range but the result is a mask,
+lower and upper lengths must be equal to the number of channels
+*/
+Mask* in_range_mask(Image* img, value_t* lower, value_t* upper) {
+	Mask* result = make_mask(img->width, img->height);
+
+	struct job job = {.img = img, .result = result, .lower = lower, .upper = upper};
+	workers_run(in_range_band, &job, img->width, img->height);
+
+	return result;
+}
+
+Mask* hsv_in_range_mask(Image* img, enum hsv_scale scale, value_t* lower, value_t* upper) {
+	if (img->channels == 3) {
+		Mask* result = make_mask(img->width, img->height);
+
+		struct job job = {.img = img, .result = result, .lower = lower, .upper = upper, .scale = scale};
+		workers_run(hsv_in_range_band, &job, img->width, img->height);
+
+		return result;
+	}
+	else {
+		fprintf(stderr, "Must have only R G B channels\n");
+		return NULL;
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+
+// MASK OPERATORS
+//----------------------------------------------------------------------------------------------------
+
+char mask_equality(Mask* msk1, Mask* msk2) {
+	if (msk1->width == msk2->width && msk1->height == msk2->height) {
+		for (size_t i = 0; i < msk1->height; i++) {
+			if (memcmp(MASK_ROW(msk1, i), MASK_ROW(msk2, i), msk1->stride * sizeof(uint64_t)) != 0)
+				return 0;
+		}
+		return 1;
+	}
+	else
+		return 0;
+}
+
+Mask* mask_not(Mask* msk) {
+	Mask* 		result 	= make_mask(msk->width, msk->height);
+	uint64_t 	tail 	= msk->width % 64 ? ((uint64_t)1 << (msk->width % 64)) -1 : ~(uint64_t)0;
+
+	for (size_t i = 0; i < msk->height; i++) {
+		uint64_t* src = MASK_ROW(msk, i);
+		uint64_t* dst = MASK_ROW(result, i);
+		for (size_t k = 0; k < msk->stride; k++)
+			dst[k] = ~src[k];
+
+		// keep the bits past the width cleared
+		if (msk->stride > 0)
+			dst[msk->stride -1] &= tail;
+	}
+	return result;
+}
+
+Mask* mask_and(Mask* msk1, Mask* msk2) {
+	return logic_operation(msk1, msk2, &and);
+}
+
+Mask* mask_or(Mask* msk1, Mask* msk2) {
+	return logic_operation(msk1, msk2, &or);
+}
+
+Mask* mask_xor(Mask* msk1, Mask* msk2) {
+	return logic_operation(msk1, msk2, &xor);
+}
+
+//----------------------------------------------------------------------------------------------------
@@ -0,0 +1,76 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MASK_H
+#define MASK_H
+
+#include "common.h"
+#include "image.h"
+
+/*
+binary image with one bit per pixel
+
+pixel x of a row is bit x % 64 of word x / 64,
+bits past the width in the last word of a row are always 0
+*/
+typedef struct {
+	size_t 		width;
+	size_t 		height;
+	size_t 		stride; // words from the start of one row to the next
+	uint64_t* 	data;
+} Mask;
+
+#define MASK_WORDS(WIDTH) (((WIDTH) + 63) / 64)
+
+/*
+pointer to the first word of row Y
+*/
+#define MASK_ROW(MSK, Y) ((MSK)->data + (Y) * (MSK)->stride)
+
+/*
+bit at (X, Y) without bounds checking
+*/
+#define MASK_BIT(MSK, X, Y) ((MASK_ROW(MSK, Y)[(X) / 64] >> ((X) % 64)) & 1)
+
+// COMMON FUNCTIONS
+//----------------------------------------------------------------------------------------------------
+
+Mask* 	make_mask(size_t width, size_t height);
+void 	free_mask(Mask* msk);
+char 	mask_get(Mask* msk, size_t x, size_t y);
+void 	mask_set(Mask* msk, size_t x, size_t y, char value);
+size_t 	mask_count(Mask* msk);
+Mask* 	image_to_mask(Image* img);
+Image* 	mask_to_image(Mask* msk, value_t on, value_t off);
+Mask* 	in_range_mask(Image* img, value_t* lower, value_t* upper);
+Mask* 	hsv_in_range_mask(Image* img, enum hsv_scale scale, value_t* lower, value_t* upper);
+
+//----------------------------------------------------------------------------------------------------
+
+// MASK OPERATORS
+//----------------------------------------------------------------------------------------------------
+
+char 	mask_equality(Mask* msk1, Mask* msk2);
+Mask* 	mask_not(Mask* msk);
+Mask* 	mask_and(Mask* msk1, Mask* msk2);
+Mask* 	mask_or(Mask* msk1, Mask* msk2);
+Mask* 	mask_xor(Mask* msk1, Mask* msk2);
+
+//----------------------------------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,192 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pool.h"
+
+#include <pthread.h>
+
+/*
+the pool is a list of free images ordered from the newest to the oldest,
+a pipeline only uses a handful of shapes so a linear search is enough.
+when the pool is over its cap the oldest images (at the tail) are freed first
+*/
+
+struct entry {
+	Image* 			img;
+	struct entry* 	prev;
+	struct entry* 	next;
+};
+
+static struct entry* 	free_list 	= NULL;
+static struct entry* 	free_tail 	= NULL;
+static size_t 			pool_bytes 	= 0;
+static size_t 			pool_cap 	= POOL_DEFAULT_CAP;
+static size_t 			buffers 	= 0;
+static size_t 			hits 		= 0;
+static size_t 			misses 		= 0;
+
+static pthread_mutex_t 	lock 		= PTHREAD_MUTEX_INITIALIZER;
+
+// HELPERS
+//----------------------------------------------------------------------------------------------------
+
+static size_t image_bytes(Image* img) {
+	return img->channels * img->width * img->height * sizeof(value_t);
+}
+
+static void destroy(Image* img) {
+	free(img->data);
+	free(img);
+}
+
+/*
+takes an entry out of the list, the lock must be held
+*/
+static void unlink_entry(struct entry* e) {
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		free_list = e->next;
+
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		free_tail = e->prev;
+}
+
+/*
+frees the oldest images until the pool fits in cap, the lock must be held
+*/
+static void trim(size_t cap) {
+	while (pool_bytes > cap) {
+		struct entry* last = free_tail;
+		unlink_entry(last);
+
+		pool_bytes -= image_bytes(last->img);
+		buffers--;
+		destroy(last->img);
+		free(last);
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+
+// POOL FUNCTIONS
+//----------------------------------------------------------------------------------------------------
+
+/*
+returns an image of the given shape, the data is not zeroed
+*/
+Image* pool_acquire(size_t channels, size_t width, size_t height) {
+	pthread_mutex_lock(&lock);
+	for (struct entry* found = free_list; found; found = found->next) {
+		Image* img = found->img;
+		if (img->channels == channels && img->width == width && img->height == height) {
+			unlink_entry(found);
+
+			pool_bytes -= image_bytes(img);
+			buffers--;
+			hits++;
+			pthread_mutex_unlock(&lock);
+
+			free(found);
+			img->refs 		= 1;
+			img->timestamp 	= 0;
+			img->dequeued 	= 0;
+			img->sequence 	= 0;
+			return img;
+		}
+	}
+	misses++;
+	pthread_mutex_unlock(&lock);
+
+	value_t* 	data 	= malloc(channels * width * height * sizeof(value_t));
+	Image* 		img 	= malloc(sizeof(Image));
+	if (data && img) {
+		img->channels 	= channels;
+		img->width 		= width;
+		img->height 	= height;
+		img->stride 	= channels * width;
+		img->data 		= data;
+		img->parent 	= NULL;
+		img->refs 		= 1;
+		img->release 	= NULL;
+		img->owner 		= NULL;
+		img->timestamp 	= 0;
+		img->dequeued 	= 0;
+		img->sequence 	= 0;
+		return img;
+	}
+	else {
+		fprintf(stderr, "Cannot allocate image\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*
+gives an image back to the pool, images larger than the cap are freed
+only images owning their data can be given back
+*/
+void pool_release(Image* img) {
+	size_t 			size 	= image_bytes(img);
+	struct entry* 	e 		= malloc(sizeof(struct entry));
+
+	pthread_mutex_lock(&lock);
+	if (e == NULL || size > pool_cap) {
+		pthread_mutex_unlock(&lock);
+		free(e);
+		destroy(img);
+		return;
+	}
+
+	e->img 		= img;
+	e->prev 	= NULL;
+	e->next 	= free_list;
+	if (free_list)
+		free_list->prev = e;
+	else
+		free_tail = e;
+	free_list 	= e;
+
+	pool_bytes += size;
+	buffers++;
+	trim(pool_cap);
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+sets the amount of bytes the pool may hold, 0 disables the pool
+*/
+void pool_set_cap(size_t bytes) {
+	pthread_mutex_lock(&lock);
+	pool_cap = bytes;
+	trim(pool_cap);
+	pthread_mutex_unlock(&lock);
+}
+
+void pool_get_stats(struct pool_stats* stats) {
+	pthread_mutex_lock(&lock);
+	stats->hits 	= hits;
+	stats->misses 	= misses;
+	stats->buffers 	= buffers;
+	stats->bytes 	= pool_bytes;
+	stats->cap 		= pool_cap;
+	pthread_mutex_unlock(&lock);
+}
+
+//----------------------------------------------------------------------------------------------------
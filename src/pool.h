@@ -0,0 +1,48 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include "common.h"
+#include "image.h"
+
+/*
+freed images are kept in the pool and handed out again
+to the next image of the same shape (channels, width, height)
+*/
+
+struct pool_stats {
+	size_t hits;
+	size_t misses;
+	size_t buffers; // images held by the pool
+	size_t bytes; 	// bytes held by the pool
+	size_t cap;
+};
+
+// POOL FUNCTIONS
+//----------------------------------------------------------------------------------------------------
+
+Image* 	pool_acquire(size_t channels, size_t width, size_t height);
+void 	pool_release(Image* img);
+void 	pool_set_cap(size_t bytes);
+void 	pool_get_stats(struct pool_stats* stats);
+
+//----------------------------------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,357 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "record.h"
+#include "pool.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define ALIGN(SIZE) (((SIZE) + RECORD_ALIGN -1) / RECORD_ALIGN * RECORD_ALIGN)
+
+/*
+playback state of a recording, frames are copied out of the mapped file
+*/
+struct playback {
+	void* 					base;
+	size_t 					length;
+	struct record_header* 	header;
+	size_t 					frames, next;
+	uint64_t 				start; 	// time the first frame was played
+	uint64_t 				first; 	// timestamp of the first frame
+	char 					realtime, loop;
+};
+
+// HELPERS
+//----------------------------------------------------------------------------------------------------
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static size_t frame_bytes(struct record_header* header) {
+	return (size_t)header->channels * header->width * header->height;
+}
+
+/*
+returns 0 if the frame could not be written completely
+*/
+static char write_frame(Recorder* rec, struct queued_frame* queued) {
+	static const uint8_t padding[RECORD_ALIGN] = {0};
+
+	struct record_frame frame = {0};
+	frame.timestamp = queued->timestamp;
+	frame.sequence 	= queued->sequence;
+
+	Image* img 		= queued->img;
+	size_t row_size = img->width * img->channels;
+
+	if (fwrite(&frame, sizeof(frame), 1, rec->file) != 1)
+		return 0;
+	for (size_t i = 0; i < img->height; i++) {
+		if (fwrite(IMAGE_ROW(img, i), sizeof(value_t), row_size, rec->file) != row_size)
+			return 0;
+	}
+
+	size_t pad = rec->header.frame_size - sizeof(frame) - row_size * img->height;
+	return fwrite(padding, 1, pad, rec->file) == pad;
+}
+
+/*
+writes the queued frames until the recorder is closed and the queue is empty
+*/
+static void* writer_loop(void* arg) {
+	Recorder* rec = arg;
+
+	pthread_mutex_lock(&rec->lock);
+	for (;;) {
+		while (rec->count == 0 && !rec->closing)
+			pthread_cond_wait(&rec->ready, &rec->lock);
+		if (rec->count == 0)
+			break;
+
+		struct queued_frame queued = rec->queue[rec->head];
+		rec->head = (rec->head +1) % RECORD_QUEUE_SIZE;
+		rec->count--;
+
+		char first 	= rec->written == 0;
+		char ok 	= !rec->failed;
+		pthread_mutex_unlock(&rec->lock);
+
+		// the shape is known once the first frame was given
+		if (ok && first)
+			ok = fwrite(&rec->header, sizeof(rec->header), 1, rec->file) == 1;
+		if (ok)
+			ok = write_frame(rec, &queued);
+		free_image(queued.img);
+
+		pthread_mutex_lock(&rec->lock);
+		if (ok)
+			rec->written++;
+		else {
+			if (!rec->failed)
+				fprintf(stderr, "Cannot write recording, later frames are dropped\n");
+			rec->failed = 1;
+			rec->dropped++;
+		}
+	}
+	pthread_mutex_unlock(&rec->lock);
+
+	return NULL;
+}
+
+static void sleep_until(uint64_t time) {
+	uint64_t now = now_ns();
+	if (now < time) {
+		struct timespec ts = {(time - now) / 1000000000, (time - now) % 1000000000};
+		nanosleep(&ts, NULL);
+	}
+}
+
+static Image* playback_read_frame(Device* dev) {
+	struct playback* pb = dev->backend;
+
+	if (pb->next == pb->frames) {
+		if (!pb->loop || pb->frames == 0)
+			return NULL;
+		pb->next = 0;
+	}
+
+	struct record_frame* frame = (struct record_frame*)((uint8_t*)pb->base +
+		sizeof(struct record_header) + pb->next * pb->header->frame_size);
+
+	// frames are played at the pace they were recorded
+	if (pb->realtime) {
+		if (pb->next == 0) {
+			pb->start = now_ns();
+			pb->first = frame->timestamp;
+		}
+		else
+			sleep_until(pb->start + (frame->timestamp - pb->first));
+	}
+	pb->next++;
+
+	Image* img = pool_acquire(pb->header->channels, pb->header->width, pb->header->height);
+	memcpy(img->data, frame +1, frame_bytes(pb->header));
+	img->timestamp 	= frame->timestamp;
+	img->sequence 	= frame->sequence;
+
+	return img;
+}
+
+static void playback_free(Device* dev) {
+	struct playback* pb = dev->backend;
+	munmap(pb->base, pb->length);
+	free(pb);
+	free(dev);
+}
+
+static const struct device_ops playback_ops = {
+	playback_read_frame,
+	playback_free,
+};
+
+//----------------------------------------------------------------------------------------------------
+
+// RECORDER FUNCTIONS
+//----------------------------------------------------------------------------------------------------
+
+Recorder* make_recorder(const char* file) {
+	Recorder* rec = calloc(1, sizeof(Recorder));
+	if (rec == NULL) {
+		fprintf(stderr, "Cannot allocate recorder\n");
+		exit(EXIT_FAILURE);
+	}
+
+	rec->file = fopen(file, "wb");
+	if (rec->file == NULL) {
+		fprintf(stderr, "Cannot open file\n");
+		free(rec);
+		return NULL;
+	}
+
+	memcpy(rec->header.magic, RECORD_MAGIC, sizeof(rec->header.magic));
+	rec->header.version = RECORD_VERSION;
+
+	pthread_mutex_init(&rec->lock, NULL);
+	pthread_cond_init(&rec->ready, NULL);
+
+	if (pthread_create(&rec->thread, NULL, writer_loop, rec) != 0) {
+		fprintf(stderr, "Cannot start recorder thread\n");
+		fclose(rec->file);
+		free(rec);
+		return NULL;
+	}
+
+	return rec;
+}
+
+/*
+queues a copy of img to be written,
+returns 0 if the frame was dropped or doesn't have the shape of the first frame
+*/
+char record_frame(Recorder* rec, Image* img) {
+	Image* copy = pool_acquire(img->channels, img->width, img->height);
+	for (size_t i = 0; i < img->height; i++)
+		memcpy(IMAGE_ROW(copy, i), IMAGE_ROW(img, i), img->width * img->channels);
+
+	// device frames keep the time they were captured at and the sequence number of the driver
+	struct queued_frame queued = {copy, img->timestamp ? img->timestamp : now_ns(), img->sequence};
+
+	pthread_mutex_lock(&rec->lock);
+	struct record_header* header = &rec->header;
+
+	if (header->frame_size == 0) {
+		header->channels 	= img->channels;
+		header->width 		= img->width;
+		header->height 		= img->height;
+		header->frame_size 	= ALIGN(sizeof(struct record_frame) + frame_bytes(header));
+	}
+	else if (header->channels != img->channels || header->width != img->width || header->height != img->height) {
+		pthread_mutex_unlock(&rec->lock);
+		fprintf(stderr, "Recorded frames must have the same shape\n");
+		free_image(copy);
+		return 0;
+	}
+
+	if (rec->count == RECORD_QUEUE_SIZE || rec->failed) {
+		rec->dropped++;
+		pthread_mutex_unlock(&rec->lock);
+		free_image(copy);
+		return 0;
+	}
+
+	rec->queue[(rec->head + rec->count) % RECORD_QUEUE_SIZE] = queued;
+	rec->count++;
+	pthread_cond_signal(&rec->ready);
+	pthread_mutex_unlock(&rec->lock);
+
+	return 1;
+}
+
+void recorder_stats(Recorder* rec, size_t* written, size_t* dropped, char* failed) {
+	pthread_mutex_lock(&rec->lock);
+	*written 	= rec->written;
+	*dropped 	= rec->dropped;
+	*failed 	= rec->failed;
+	pthread_mutex_unlock(&rec->lock);
+}
+
+/*
+writes the queued frames and closes the recording,
+returns 0 if the recording could not be written completely
+*/
+char free_recorder(Recorder* rec) {
+	pthread_mutex_lock(&rec->lock);
+	rec->closing = 1;
+	pthread_cond_signal(&rec->ready);
+	pthread_mutex_unlock(&rec->lock);
+
+	pthread_join(rec->thread, NULL);
+
+	// the frame count covers only the frames written completely
+	char ok = !rec->failed;
+	if (rec->written > 0) {
+		rec->header.frames = rec->written;
+		if (fseek(rec->file, 0, SEEK_SET) != 0 || fwrite(&rec->header, sizeof(rec->header), 1, rec->file) != 1)
+			ok = 0;
+	}
+	if (fclose(rec->file) != 0)
+		ok = 0;
+	if (!ok)
+		fprintf(stderr, "Recording is incomplete\n");
+
+	pthread_mutex_destroy(&rec->lock);
+	pthread_cond_destroy(&rec->ready);
+	free(rec);
+
+	return ok;
+}
+
+//----------------------------------------------------------------------------------------------------
+
+// PLAYBACK
+//----------------------------------------------------------------------------------------------------
+
+/*
+plays a recording as a device,
+realtime plays the frames at the pace they were recorded, otherwise as fast as they are read.
+with loop the recording starts over at the end, otherwise read_frame returns NULL
+*/
+Device* make_playback_device(const char* file, char realtime, char loop) {
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open file\n");
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct record_header)) {
+		fprintf(stderr, "Invalid recording\n");
+		close(fd);
+		return NULL;
+	}
+
+	void* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (base == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+
+	// the shape comes from the file, its size must not overflow
+	struct record_header* header = base;
+	if (memcmp(header->magic, RECORD_MAGIC, sizeof(header->magic)) != 0 || header->version != RECORD_VERSION ||
+			header->channels == 0 || header->width == 0 || header->height == 0 ||
+			header->width > (SIZE_MAX - sizeof(struct record_frame)) / header->channels / header->height ||
+			header->frame_size < sizeof(struct record_frame) + frame_bytes(header)) {
+		fprintf(stderr, "Invalid recording\n");
+		munmap(base, st.st_size);
+		return NULL;
+	}
+
+	struct playback* 	pb 	= calloc(1, sizeof(struct playback));
+	Device* 			dev = calloc(1, sizeof(Device));
+	if (pb == NULL || dev == NULL) {
+		fprintf(stderr, "Cannot allocate device\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// recordings that were not closed have no frame count
+	size_t stored = (st.st_size - sizeof(struct record_header)) / header->frame_size;
+
+	pb->base 		= base;
+	pb->length 		= st.st_size;
+	pb->header 		= header;
+	pb->frames 		= header->frames && header->frames < stored ? header->frames : stored;
+	pb->realtime 	= realtime;
+	pb->loop 		= loop;
+
+	dev->ops 		= &playback_ops;
+	dev->width 		= header->width;
+	dev->height 	= header->height;
+	dev->backend 	= pb;
+
+	return dev;
+}
+
+//----------------------------------------------------------------------------------------------------
@@ -0,0 +1,98 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include "common.h"
+#include "image.h"
+#include "device.h"
+
+#include <pthread.h>
+
+/*
+raw recording container
+
+a header followed by frames of the same size,
+every frame is a frame header followed by the rows of the image.
+headers and frames are RECORD_ALIGN bytes aligned so mapped frames are aligned too
+*/
+
+#define RECORD_MAGIC 	"KSTRLRAW"
+#define RECORD_VERSION 	1
+#define RECORD_ALIGN 	64
+
+struct record_header {
+	char 		magic[8];
+	uint32_t 	version;
+	uint32_t 	channels;
+	uint32_t 	width;
+	uint32_t 	height;
+	uint64_t 	frame_size; // bytes of a frame with its header
+	uint64_t 	frames; 	// written when the recording is closed, 0 if it wasn't
+	uint8_t 	reserved[24];
+};
+
+struct record_frame {
+	uint64_t 	timestamp; 	// nanoseconds, monotonic
+	uint64_t 	sequence;
+	uint8_t 	reserved[48];
+};
+
+/*
+frames are queued by record_frame and written by a background thread,
+frames are dropped when the queue is full so capture is never stalled.
+after a failed write (a full disk) the recording stops and later frames are dropped
+*/
+struct queued_frame {
+	Image* 		img;
+	uint64_t 	timestamp;
+	uint64_t 	sequence;
+};
+
+typedef struct Recorder {
+	FILE* 					file;
+	pthread_t 				thread;
+	pthread_mutex_t 		lock;
+	pthread_cond_t 			ready;
+	struct queued_frame 	queue[RECORD_QUEUE_SIZE];
+	size_t 					head, count;
+	char 					closing;
+	struct record_header 	header;
+	size_t 					written, dropped;
+	char 					failed; 	// a write failed
+} Recorder;
+
+// RECORDER FUNCTIONS
+//----------------------------------------------------------------------------------------------------
+
+Recorder* 	make_recorder(const char* file);
+char 		record_frame(Recorder* rec, Image* img);
+void 		recorder_stats(Recorder* rec, size_t* written, size_t* dropped, char* failed);
+char 		free_recorder(Recorder* rec);
+
+//----------------------------------------------------------------------------------------------------
+
+// PLAYBACK
+//----------------------------------------------------------------------------------------------------
+
+Device* 	make_playback_device(const char* file, char realtime, char loop);
+
+//----------------------------------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,613 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "simd.h"
+
+#ifdef KESTREL_X86
+
+#include <immintrin.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+// two 16 bit coefficients in a 32 bit word, lo multiplies the even and hi the odd 16 bit lanes in madd
+#define PAIR16(LO, HI) ((int)((uint16_t)(LO) | (uint32_t)(uint16_t)(HI) << 16))
+
+// HELPERS
+//----------------------------------------------------------------------------------------------------
+
+/*
+splits 32 interleaved 3 channel pixels (6 vectors) into planes
+on return v[0], v[1] hold channel 0, v[2], v[3] channel 1 and v[4], v[5] channel 2
+
+five rounds of the same unpack pattern undo the interleaving,
+the 256 bit version does the same for each 128 bit lane
+*/
+static inline SSE2 void sse2_deinterleave3(__m128i v[6]) {
+	for (int round = 0; round < 5; round++) {
+		__m128i t[6];
+		for (int k = 0; k < 3; k++) {
+			t[2*k]		= _mm_unpacklo_epi8(v[k], v[k +3]);
+			t[2*k +1]	= _mm_unpackhi_epi8(v[k], v[k +3]);
+		}
+		for (int k = 0; k < 6; k++)
+			v[k] = t[k];
+	}
+}
+
+static inline AVX2 void avx2_deinterleave3(__m256i v[6]) {
+	for (int round = 0; round < 5; round++) {
+		__m256i t[6];
+		for (int k = 0; k < 3; k++) {
+			t[2*k]		= _mm256_unpacklo_epi8(v[k], v[k +3]);
+			t[2*k +1]	= _mm256_unpackhi_epi8(v[k], v[k +3]);
+		}
+		for (int k = 0; k < 6; k++)
+			v[k] = t[k];
+	}
+}
+
+/*
+the inverse of sse2_deinterleave3, planes laid out as it leaves them
+are put back into 32 interleaved 3 channel pixels.
+each round splits the even and odd bytes, which undoes one round of unpacks
+*/
+static inline SSE2 void sse2_interleave3(__m128i v[6]) {
+	const __m128i low = _mm_set1_epi16(0x00FF);
+	for (int round = 0; round < 5; round++) {
+		__m128i t[6];
+		for (int k = 0; k < 3; k++) {
+			t[k] 	= _mm_packus_epi16(_mm_and_si128(v[2*k], low), _mm_and_si128(v[2*k +1], low));
+			t[k +3] = _mm_packus_epi16(_mm_srli_epi16(v[2*k], 8), _mm_srli_epi16(v[2*k +1], 8));
+		}
+		for (int k = 0; k < 6; k++)
+			v[k] = t[k];
+	}
+}
+
+/*
+shuffles putting 16 bytes of each plane back in interleaved order,
+interleave[o][c] moves the bytes of plane c that land in the o-th 16 bytes of the output
+*/
+static inline AVX2 void avx2_interleave_table(__m128i interleave[3][3]) {
+	for (int o = 0; o < 3; o++) {
+		for (int c = 0; c < 3; c++) {
+			char m[16];
+			for (int i = 0; i < 16; i++)
+				m[i] = (o * 16 + i) % 3 == c ? (o * 16 + i) / 3 : -1;
+			interleave[o][c] = _mm_loadu_si128((const __m128i*)m);
+		}
+	}
+}
+
+/*
+stores 16 pixels given as 3 planes of bytes as 48 interleaved values
+*/
+static inline AVX2 void avx2_store3(const __m128i planes[3], __m128i interleave[3][3], value_t* out) {
+	for (int o = 0; o < 3; o++) {
+		__m128i bytes = _mm_or_si128(_mm_shuffle_epi8(planes[0], interleave[o][0]),
+			_mm_or_si128(_mm_shuffle_epi8(planes[1], interleave[o][1]),
+			_mm_shuffle_epi8(planes[2], interleave[o][2])));
+		_mm_storeu_si128((__m128i*)(out + o * 16), bytes);
+	}
+}
+
+/*
+bt.601 limited range yuv to rgb, same math as yuv_pixel() in kernel.c
+y holds the 16 bit luma of 8 pixels and uv the 16 bit u v of their 4 pairs,
+rgb receives the 16 bit channels of the pixels before clamping.
+madd keeps the products in 32 bits, 298 * 239 does not fit in 16
+*/
+static inline SSE2 void sse2_yuv8(__m128i y, __m128i uv, __m128i rgb[3]) {
+	const __m128i one 	= _mm_set1_epi16(1);
+	const __m128i luma 	= _mm_set1_epi32(PAIR16(298, 128));
+
+	__m128i ym 	= _mm_sub_epi16(y, _mm_set1_epi16(16));
+	__m128i c 	= _mm_sub_epi16(uv, _mm_set1_epi16(128));
+
+	// 298 * (y - 16) + 128 of pixels 0-3 and 4-7
+	__m128i l0 	= _mm_madd_epi16(_mm_unpacklo_epi16(ym, one), luma);
+	__m128i l1 	= _mm_madd_epi16(_mm_unpackhi_epi16(ym, one), luma);
+
+	__m128i chroma[3] = {
+		_mm_madd_epi16(c, _mm_set1_epi32(PAIR16(0, 409))),
+		_mm_madd_epi16(c, _mm_set1_epi32(PAIR16(-100, -208))),
+		_mm_madd_epi16(c, _mm_set1_epi32(PAIR16(516, 0))),
+	};
+
+	// both pixels of a pair get the chroma of the pair
+	for (int k = 0; k < 3; k++) {
+		__m128i lo = _mm_srai_epi32(_mm_add_epi32(l0, _mm_unpacklo_epi32(chroma[k], chroma[k])), 8);
+		__m128i hi = _mm_srai_epi32(_mm_add_epi32(l1, _mm_unpackhi_epi32(chroma[k], chroma[k])), 8);
+		rgb[k] = _mm_packs_epi32(lo, hi);
+	}
+}
+
+/*
+same as sse2_yuv8 for 16 pixels, each 128 bit lane holds 8 pixels and their 4 pairs
+*/
+static inline AVX2 void avx2_yuv16(__m256i y, __m256i uv, __m256i rgb[3]) {
+	const __m256i one 	= _mm256_set1_epi16(1);
+	const __m256i luma 	= _mm256_set1_epi32(PAIR16(298, 128));
+
+	__m256i ym 	= _mm256_sub_epi16(y, _mm256_set1_epi16(16));
+	__m256i c 	= _mm256_sub_epi16(uv, _mm256_set1_epi16(128));
+
+	__m256i l0 	= _mm256_madd_epi16(_mm256_unpacklo_epi16(ym, one), luma);
+	__m256i l1 	= _mm256_madd_epi16(_mm256_unpackhi_epi16(ym, one), luma);
+
+	__m256i chroma[3] = {
+		_mm256_madd_epi16(c, _mm256_set1_epi32(PAIR16(0, 409))),
+		_mm256_madd_epi16(c, _mm256_set1_epi32(PAIR16(-100, -208))),
+		_mm256_madd_epi16(c, _mm256_set1_epi32(PAIR16(516, 0))),
+	};
+
+	for (int k = 0; k < 3; k++) {
+		__m256i lo = _mm256_srai_epi32(_mm256_add_epi32(l0, _mm256_unpacklo_epi32(chroma[k], chroma[k])), 8);
+		__m256i hi = _mm256_srai_epi32(_mm256_add_epi32(l1, _mm256_unpackhi_epi32(chroma[k], chroma[k])), 8);
+		rgb[k] = _mm256_packs_epi32(lo, hi);
+	}
+}
+
+/*
+all ones where lo <= v <= hi, unsigned compare
+*/
+static inline SSE2 __m128i sse2_in_bounds(__m128i v, __m128i lo, __m128i hi) {
+	return _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, lo), v), _mm_cmpeq_epi8(_mm_min_epu8(v, hi), v));
+}
+
+static inline AVX2 __m256i avx2_in_bounds(__m256i v, __m256i lo, __m256i hi) {
+	return _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, lo), v),
+		_mm256_cmpeq_epi8(_mm256_min_epu8(v, hi), v));
+}
+
+/*
+fixed point hsv of 8 pixels held as 32 bit integers
+same math as hsv_fixed_pixel() in kernel.c
+*/
+static inline AVX2 void avx2_hsv8(__m256i r, __m256i g, __m256i b, __m256i hsv[3],
+		const int* sdiv_table, const int* hdiv_table) {
+	__m256i half 	= _mm256_set1_epi32(1 << (HSV_SHIFT -1));
+	__m256i max 	= _mm256_max_epi32(_mm256_max_epi32(r, g), b);
+	__m256i min 	= _mm256_min_epi32(_mm256_min_epi32(r, g), b);
+	__m256i df 		= _mm256_sub_epi32(max, min);
+
+	__m256i is_r 	= _mm256_cmpeq_epi32(max, r);
+	__m256i is_g 	= _mm256_cmpeq_epi32(max, g);
+	__m256i hr 		= _mm256_sub_epi32(g, b);
+	__m256i hg 		= _mm256_add_epi32(_mm256_sub_epi32(b, r), _mm256_slli_epi32(df, 1));
+	__m256i hb 		= _mm256_add_epi32(_mm256_sub_epi32(r, g), _mm256_slli_epi32(df, 2));
+	__m256i h 		= _mm256_blendv_epi8(_mm256_blendv_epi8(hb, hg, is_g), hr, is_r);
+
+	h = _mm256_mullo_epi32(h, _mm256_i32gather_epi32(hdiv_table, df, 4));
+	h = _mm256_srai_epi32(_mm256_add_epi32(h, half), HSV_SHIFT);
+	h = _mm256_add_epi32(h, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), h), _mm256_set1_epi32(180)));
+
+	__m256i s = _mm256_mullo_epi32(df, _mm256_i32gather_epi32(sdiv_table, max, 4));
+	s = _mm256_srai_epi32(_mm256_add_epi32(s, half), HSV_SHIFT);
+
+	hsv[0] = h;
+	hsv[1] = s;
+	hsv[2] = max;
+}
+
+/*
+packs two vectors of 8 32 bit integers in 0-255 into 16 bytes
+*/
+static inline AVX2 __m128i avx2_pack16(__m256i a, __m256i b) {
+	__m256i w = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+	return _mm_packus_epi16(_mm256_castsi256_si128(w), _mm256_extracti128_si256(w, 1));
+}
+
+static inline SSE2 __m128i sse2_select(__m128i mask, __m128i on, __m128i off) {
+	return _mm_or_si128(_mm_and_si128(mask, on), _mm_andnot_si128(mask, off));
+}
+
+static inline AVX2 __m256i avx2_select(__m256i mask, __m256i on, __m256i off) {
+	return _mm256_blendv_epi8(off, on, mask);
+}
+
+//----------------------------------------------------------------------------------------------------
+
+// SSE2
+//----------------------------------------------------------------------------------------------------
+
+size_t SSE2 sse2_in_range1(const value_t* src, value_t* dst, size_t width,
+		const value_t* lower, const value_t* upper, value_t on, value_t off) {
+
+	__m128i lo 		= _mm_set1_epi8(lower[0]);
+	__m128i hi 		= _mm_set1_epi8(upper[0]);
+	__m128i von 	= _mm_set1_epi8(on);
+	__m128i voff 	= _mm_set1_epi8(off);
+
+	size_t j = 0;
+	for (; j + 16 <= width; j += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + j));
+		_mm_storeu_si128((__m128i*)(dst + j), sse2_select(sse2_in_bounds(v, lo, hi), von, voff));
+	}
+	return j;
+}
+
+size_t SSE2 sse2_in_range3(const value_t* src, value_t* dst, size_t width,
+		const value_t* lower, const value_t* upper, value_t on, value_t off) {
+
+	__m128i lo[3], hi[3];
+	for (int c = 0; c < 3; c++) {
+		lo[c] = _mm_set1_epi8(lower[c]);
+		hi[c] = _mm_set1_epi8(upper[c]);
+	}
+	__m128i von 	= _mm_set1_epi8(on);
+	__m128i voff 	= _mm_set1_epi8(off);
+
+	size_t j = 0;
+	for (; j + 32 <= width; j += 32) {
+		__m128i v[6];
+		for (int k = 0; k < 6; k++)
+			v[k] = _mm_loadu_si128((const __m128i*)(src + j * 3 + k * 16));
+
+		sse2_deinterleave3(v);
+
+		for (int h = 0; h < 2; h++) {
+			__m128i mask = _mm_and_si128(sse2_in_bounds(v[h], lo[0], hi[0]),
+				_mm_and_si128(sse2_in_bounds(v[2 + h], lo[1], hi[1]), sse2_in_bounds(v[4 + h], lo[2], hi[2])));
+			_mm_storeu_si128((__m128i*)(dst + j + h * 16), sse2_select(mask, von, voff));
+		}
+	}
+	return j;
+}
+
+/*
+8 pixels per iteration, see kernel_sobel_horizontal() for the math
+*/
+size_t SSE2 sse2_sobel(const int16_t* smooth, const int16_t* diff, value_t* dst, size_t width,
+		enum sobel_norm norm) {
+
+	__m128i zero 	= _mm_setzero_si128();
+	__m128i bias 	= _mm_set1_epi16(128);
+
+	size_t j = 0;
+	for (; j + 8 <= width; j += 8) {
+		__m128i gx = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(smooth + j +1)),
+			_mm_loadu_si128((const __m128i*)(smooth + j -1)));
+
+		__m128i d 	= _mm_loadu_si128((const __m128i*)(diff + j));
+		__m128i gy 	= _mm_add_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i*)(diff + j -1)),
+			_mm_loadu_si128((const __m128i*)(diff + j +1))), _mm_add_epi16(d, d));
+
+		if (norm == SOBEL_L1) {
+			__m128i ax = _mm_max_epi16(gx, _mm_sub_epi16(zero, gx));
+			__m128i ay = _mm_max_epi16(gy, _mm_sub_epi16(zero, gy));
+			_mm_storel_epi64((__m128i*)(dst + j), _mm_packus_epi16(_mm_add_epi16(ax, ay), zero));
+		}
+		else if (norm == SOBEL_L2) {
+			__m128i lo = _mm_unpacklo_epi16(gx, gy);
+			__m128i hi = _mm_unpackhi_epi16(gx, gy);
+			lo = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(_mm_madd_epi16(lo, lo))));
+			hi = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(_mm_madd_epi16(hi, hi))));
+			_mm_storel_epi64((__m128i*)(dst + j), _mm_packus_epi16(_mm_packs_epi32(lo, hi), zero));
+		}
+		else {
+			__m128i x = _mm_add_epi16(_mm_srai_epi16(gx, 3), bias);
+			__m128i y = _mm_add_epi16(_mm_srai_epi16(gy, 3), bias);
+			__m128i b = _mm_packus_epi16(x, y); // 8 bytes of gx then 8 bytes of gy
+			_mm_storeu_si128((__m128i*)(dst + j * 2), _mm_unpacklo_epi8(b, _mm_srli_si128(b, 8)));
+		}
+	}
+	return j;
+}
+
+/*
+movemask of (v == 0) gives the cleared pixels, one bit per byte
+*/
+size_t SSE2 sse2_pack_mask(const value_t* src, uint64_t* dst, size_t width) {
+	const __m128i zero = _mm_setzero_si128();
+
+	size_t x = 0;
+	for (; x + 64 <= width; x += 64) {
+		uint64_t word = 0;
+		for (int k = 0; k < 4; k++) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(src + x + k * 16));
+			word |= (uint64_t)(uint16_t)~_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) << (k * 16);
+		}
+		dst[x / 64] = word;
+	}
+	return x;
+}
+
+/*
+the y values are the low bytes of the 16 bit yuyv words
+*/
+size_t SSE2 sse2_yuyv_luma(const value_t* src, value_t* dst, size_t width) {
+	const __m128i low = _mm_set1_epi16(0x00FF);
+
+	size_t j = 0;
+	for (; j + 16 <= width; j += 16) {
+		__m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)(src + j * 2)), low);
+		__m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)(src + j * 2 + 16)), low);
+		_mm_storeu_si128((__m128i*)(dst + j), _mm_packus_epi16(a, b));
+	}
+	return j;
+}
+
+/*
+clamps 32 pixels of 16 bit channels (4 vectors of 8 pixels per channel) to bytes
+and stores them interleaved
+*/
+static inline SSE2 void sse2_store_rgb32(__m128i rgb[3][4], value_t* out) {
+	__m128i v[6];
+	for (int c = 0; c < 3; c++) {
+		v[2*c] 		= _mm_packus_epi16(rgb[c][0], rgb[c][1]);
+		v[2*c +1] 	= _mm_packus_epi16(rgb[c][2], rgb[c][3]);
+	}
+
+	sse2_interleave3(v);
+	for (int k = 0; k < 6; k++)
+		_mm_storeu_si128((__m128i*)(out + k * 16), v[k]);
+}
+
+/*
+32 pixels per iteration, the low bytes of the yuyv words are the y values and the high bytes u v
+*/
+size_t SSE2 sse2_yuyv_to_rgb(const value_t* src, value_t* dst, size_t width) {
+	const __m128i low = _mm_set1_epi16(0x00FF);
+
+	size_t j = 0;
+	for (; j + 32 <= width; j += 32) {
+		__m128i rgb[3][4];
+		for (int k = 0; k < 4; k++) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(src + j * 2 + k * 16));
+			__m128i px[3];
+			sse2_yuv8(_mm_and_si128(v, low), _mm_srli_epi16(v, 8), px);
+			for (int c = 0; c < 3; c++)
+				rgb[c][k] = px[c];
+		}
+		sse2_store_rgb32(rgb, dst + j * 3);
+	}
+	return j;
+}
+
+/*
+32 pixels per iteration, the u v row already has the layout of the yuyv chroma
+*/
+size_t SSE2 sse2_nv12_to_rgb(const value_t* y, const value_t* uv, value_t* dst, size_t width) {
+	const __m128i zero = _mm_setzero_si128();
+
+	size_t j = 0;
+	for (; j + 32 <= width; j += 32) {
+		__m128i rgb[3][4];
+		for (int k = 0; k < 2; k++) {
+			__m128i vy 	= _mm_loadu_si128((const __m128i*)(y + j + k * 16));
+			__m128i vuv = _mm_loadu_si128((const __m128i*)(uv + j + k * 16));
+			__m128i lo[3], hi[3];
+			sse2_yuv8(_mm_unpacklo_epi8(vy, zero), _mm_unpacklo_epi8(vuv, zero), lo);
+			sse2_yuv8(_mm_unpackhi_epi8(vy, zero), _mm_unpackhi_epi8(vuv, zero), hi);
+			for (int c = 0; c < 3; c++) {
+				rgb[c][2*k] 	= lo[c];
+				rgb[c][2*k +1] 	= hi[c];
+			}
+		}
+		sse2_store_rgb32(rgb, dst + j * 3);
+	}
+	return j;
+}
+
+//----------------------------------------------------------------------------------------------------
+
+// AVX2
+//----------------------------------------------------------------------------------------------------
+
+size_t AVX2 avx2_in_range1(const value_t* src, value_t* dst, size_t width,
+		const value_t* lower, const value_t* upper, value_t on, value_t off) {
+
+	__m256i lo 		= _mm256_set1_epi8(lower[0]);
+	__m256i hi 		= _mm256_set1_epi8(upper[0]);
+	__m256i von 	= _mm256_set1_epi8(on);
+	__m256i voff 	= _mm256_set1_epi8(off);
+
+	size_t j = 0;
+	for (; j + 32 <= width; j += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(src + j));
+		_mm256_storeu_si256((__m256i*)(dst + j), avx2_select(avx2_in_bounds(v, lo, hi), von, voff));
+	}
+	return j;
+}
+
+/*
+64 pixels per iteration, the low lanes hold pixels 0-31 and the high lanes pixels 32-63
+*/
+size_t AVX2 avx2_in_range3(const value_t* src, value_t* dst, size_t width,
+		const value_t* lower, const value_t* upper, value_t on, value_t off) {
+
+	__m256i lo[3], hi[3];
+	for (int c = 0; c < 3; c++) {
+		lo[c] = _mm256_set1_epi8(lower[c]);
+		hi[c] = _mm256_set1_epi8(upper[c]);
+	}
+	__m256i von 	= _mm256_set1_epi8(on);
+	__m256i voff 	= _mm256_set1_epi8(off);
+
+	size_t j = 0;
+	for (; j + 64 <= width; j += 64) {
+		const value_t* p = src + j * 3;
+		__m256i v[6];
+		for (int k = 0; k < 6; k++)
+			v[k] = _mm256_inserti128_si256(_mm256_castsi128_si256(
+				_mm_loadu_si128((const __m128i*)(p + k * 16))),
+				_mm_loadu_si128((const __m128i*)(p + 96 + k * 16)), 1);
+
+		avx2_deinterleave3(v);
+
+		__m256i mask[2];
+		for (int h = 0; h < 2; h++)
+			mask[h] = avx2_select(_mm256_and_si256(avx2_in_bounds(v[h], lo[0], hi[0]),
+				_mm256_and_si256(avx2_in_bounds(v[2 + h], lo[1], hi[1]), avx2_in_bounds(v[4 + h], lo[2], hi[2]))),
+				von, voff);
+
+		_mm256_storeu_si256((__m256i*)(dst + j), _mm256_permute2x128_si256(mask[0], mask[1], 0x20));
+		_mm256_storeu_si256((__m256i*)(dst + j + 32), _mm256_permute2x128_si256(mask[0], mask[1], 0x31));
+	}
+	return j;
+}
+
+/*
+32 pixels per iteration, gathers replace the divisions of the float conversion
+*/
+size_t AVX2 avx2_rgb_to_hsv_fixed(const value_t* src, value_t* dst, size_t width,
+		const int* sdiv_table, const int* hdiv_table) {
+
+	__m128i interleave[3][3];
+	avx2_interleave_table(interleave);
+
+	size_t j = 0;
+	for (; j + 32 <= width; j += 32) {
+		__m128i v[6];
+		for (int k = 0; k < 6; k++)
+			v[k] = _mm_loadu_si128((const __m128i*)(src + j * 3 + k * 16));
+
+		sse2_deinterleave3(v);
+
+		for (int h = 0; h < 2; h++) {
+			__m256i lo[3], hi[3];
+			avx2_hsv8(_mm256_cvtepu8_epi32(v[h]), _mm256_cvtepu8_epi32(v[2 + h]),
+				_mm256_cvtepu8_epi32(v[4 + h]), lo, sdiv_table, hdiv_table);
+			avx2_hsv8(_mm256_cvtepu8_epi32(_mm_srli_si128(v[h], 8)), _mm256_cvtepu8_epi32(_mm_srli_si128(v[2 + h], 8)),
+				_mm256_cvtepu8_epi32(_mm_srli_si128(v[4 + h], 8)), hi, sdiv_table, hdiv_table);
+
+			__m128i planes[3];
+			for (int c = 0; c < 3; c++)
+				planes[c] = avx2_pack16(lo[c], hi[c]);
+
+			avx2_store3(planes, interleave, dst + (j + h * 16) * 3);
+		}
+	}
+	return j;
+}
+
+/*
+the table is split into 16 rows of 16 entries and pshufb looks up every row.
+the value minus 16 * row is biased by 0x70 with saturation, so only values
+inside the row keep the top bit clear, the rest look up zero
+*/
+size_t AVX2 avx2_lut(const value_t* src, value_t* dst, size_t n, const value_t* lut) {
+	const __m256i step = _mm256_set1_epi8(16);
+	const __m256i bias = _mm256_set1_epi8(0x70);
+
+	size_t j = 0;
+	for (; j + 32 <= n; j += 32) {
+		__m256i v 	= _mm256_loadu_si256((const __m256i*)(src + j));
+		__m256i out = _mm256_setzero_si256();
+
+		for (int k = 0; k < 16; k++) {
+			__m256i row = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(lut + k * 16)));
+			out = _mm256_or_si256(out, _mm256_shuffle_epi8(row, _mm256_adds_epu8(v, bias)));
+			v 	= _mm256_sub_epi8(v, step);
+		}
+		_mm256_storeu_si256((__m256i*)(dst + j), out);
+	}
+	return j;
+}
+
+size_t AVX2 avx2_pack_mask(const value_t* src, uint64_t* dst, size_t width) {
+	const __m256i zero = _mm256_setzero_si256();
+
+	size_t x = 0;
+	for (; x + 64 <= width; x += 64) {
+		__m256i lo = _mm256_loadu_si256((const __m256i*)(src + x));
+		__m256i hi = _mm256_loadu_si256((const __m256i*)(src + x + 32));
+		uint32_t bits_lo = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, zero));
+		uint32_t bits_hi = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, zero));
+		dst[x / 64] = (uint64_t)bits_hi << 32 | bits_lo;
+	}
+	return x;
+}
+
+size_t AVX2 avx2_yuyv_luma(const value_t* src, value_t* dst, size_t width) {
+	const __m256i low = _mm256_set1_epi16(0x00FF);
+
+	size_t j = 0;
+	for (; j + 32 <= width; j += 32) {
+		__m256i a = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(src + j * 2)), low);
+		__m256i b = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(src + j * 2 + 32)), low);
+		// packus works within lanes, the permute puts the quarters back in order
+		__m256i y = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+		_mm256_storeu_si256((__m256i*)(dst + j), y);
+	}
+	return j;
+}
+
+/*
+clamps 32 pixels of 16 bit channels (2 vectors of 16 pixels per channel) to bytes
+and stores them interleaved
+*/
+static inline AVX2 void avx2_store_rgb32(__m256i rgb[3][2], __m128i interleave[3][3], value_t* out) {
+	__m256i bytes[3];
+	for (int c = 0; c < 3; c++)
+		bytes[c] = _mm256_permute4x64_epi64(_mm256_packus_epi16(rgb[c][0], rgb[c][1]), 0xD8);
+
+	for (int h = 0; h < 2; h++) {
+		__m128i planes[3];
+		for (int c = 0; c < 3; c++)
+			planes[c] = h ? _mm256_extracti128_si256(bytes[c], 1) : _mm256_castsi256_si128(bytes[c]);
+		avx2_store3(planes, interleave, out + h * 48);
+	}
+}
+
+size_t AVX2 avx2_yuyv_to_rgb(const value_t* src, value_t* dst, size_t width) {
+	const __m256i low = _mm256_set1_epi16(0x00FF);
+
+	__m128i interleave[3][3];
+	avx2_interleave_table(interleave);
+
+	size_t j = 0;
+	for (; j + 32 <= width; j += 32) {
+		__m256i rgb[3][2];
+		for (int k = 0; k < 2; k++) {
+			__m256i v = _mm256_loadu_si256((const __m256i*)(src + j * 2 + k * 32));
+			__m256i px[3];
+			avx2_yuv16(_mm256_and_si256(v, low), _mm256_srli_epi16(v, 8), px);
+			for (int c = 0; c < 3; c++)
+				rgb[c][k] = px[c];
+		}
+		avx2_store_rgb32(rgb, interleave, dst + j * 3);
+	}
+	return j;
+}
+
+size_t AVX2 avx2_nv12_to_rgb(const value_t* y, const value_t* uv, value_t* dst, size_t width) {
+	__m128i interleave[3][3];
+	avx2_interleave_table(interleave);
+
+	size_t j = 0;
+	for (; j + 32 <= width; j += 32) {
+		__m256i rgb[3][2];
+		for (int k = 0; k < 2; k++) {
+			__m256i vy 	= _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(y + j + k * 16)));
+			__m256i vuv = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(uv + j + k * 16)));
+			__m256i px[3];
+			avx2_yuv16(vy, vuv, px);
+			for (int c = 0; c < 3; c++)
+				rgb[c][k] = px[c];
+		}
+		avx2_store_rgb32(rgb, interleave, dst + j * 3);
+	}
+	return j;
+}
+
+//----------------------------------------------------------------------------------------------------
+
+#endif
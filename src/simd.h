@@ -0,0 +1,86 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "common.h"
+#include "image.h"
+
+/*
+vectorized versions of the row kernels
+
+every function is compiled for its own instruction set
+and must only be called after checking the cpu supports it,
+kernel_init() does the checking and picks the kernels
+
+each function handles whole blocks of pixels only and returns
+the amount of pixels done, the rest is left to the scalar kernel
+*/
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KESTREL_X86
+#endif
+
+/*
+fixed point hsv conversion divides with reciprocal tables scaled by 1 << HSV_SHIFT
+	sdiv_table[i] = (255 << HSV_SHIFT) / i
+	hdiv_table[i] = (180 << HSV_SHIFT) / (6 * i)
+*/
+#define HSV_SHIFT 12
+
+#ifdef KESTREL_X86
+
+// SSE2
+//----------------------------------------------------------------------------------------------------
+
+size_t sse2_in_range1(const value_t* src, value_t* dst, size_t width,
+		const value_t* lower, const value_t* upper, value_t on, value_t off);
+size_t sse2_in_range3(const value_t* src, value_t* dst, size_t width,
+		const value_t* lower, const value_t* upper, value_t on, value_t off);
+size_t sse2_sobel(const int16_t* smooth, const int16_t* diff, value_t* dst, size_t width,
+		enum sobel_norm norm);
+size_t sse2_pack_mask(const value_t* src, uint64_t* dst, size_t width);
+size_t sse2_yuyv_luma(const value_t* src, value_t* dst, size_t width);
+size_t sse2_yuyv_to_rgb(const value_t* src, value_t* dst, size_t width);
+size_t sse2_nv12_to_rgb(const value_t* y, const value_t* uv, value_t* dst, size_t width);
+
+//----------------------------------------------------------------------------------------------------
+
+// AVX2
+//----------------------------------------------------------------------------------------------------
+
+size_t avx2_in_range1(const value_t* src, value_t* dst, size_t width,
+		const value_t* lower, const value_t* upper, value_t on, value_t off);
+size_t avx2_in_range3(const value_t* src, value_t* dst, size_t width,
+		const value_t* lower, const value_t* upper, value_t on, value_t off);
+
+size_t avx2_rgb_to_hsv_fixed(const value_t* src, value_t* dst, size_t width,
+		const int* sdiv_table, const int* hdiv_table);
+
+size_t avx2_lut(const value_t* src, value_t* dst, size_t n, const value_t* lut);
+size_t avx2_pack_mask(const value_t* src, uint64_t* dst, size_t width);
+size_t avx2_yuyv_luma(const value_t* src, value_t* dst, size_t width);
+size_t avx2_yuyv_to_rgb(const value_t* src, value_t* dst, size_t width);
+size_t avx2_nv12_to_rgb(const value_t* y, const value_t* uv, value_t* dst, size_t width);
+
+//----------------------------------------------------------------------------------------------------
+
+#endif
+
+#endif
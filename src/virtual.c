@@ -0,0 +1,316 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "virtual.h"
+
+#include <dirent.h>
+#include <time.h>
+
+#define MIN(MIN_A,MIN_B) (((MIN_A)<(MIN_B))?(MIN_A):(MIN_B))
+#define MAX(MAX_A,MAX_B) (((MAX_A)>(MAX_B))?(MAX_A):(MAX_B))
+
+/*
+frames are due every period nanoseconds from the first frame
+*/
+struct pacer {
+	uint64_t 	period;
+	uint64_t 	start;
+	uint64_t 	frames;
+};
+
+struct sequence {
+	char** 			files;
+	size_t 			amount, next;
+	size_t 			channels; 	// of the first map, every map must have its shape
+	char 			loop;
+	char 			ended; 		// a map could not be read or had another shape
+	struct pacer 	pacer;
+};
+
+struct blob {
+	double 	x, y, dx, dy; // position and speed in pixels per frame
+	double 	radius;
+	value_t color[3];
+};
+
+struct synthetic {
+	struct blob* 	blobs;
+	size_t 			amount;
+	value_t 		noise;
+	uint64_t 		state; // random generator state
+	struct pacer 	pacer;
+};
+
+// HELPERS
+//----------------------------------------------------------------------------------------------------
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void make_pacer(struct pacer* pacer, double fps) {
+	pacer->period 	= fps > 0 ? (uint64_t)(1e9 / fps) : 0;
+	pacer->frames 	= 0;
+}
+
+/*
+sleeps until the next frame is due
+*/
+static void pace(struct pacer* pacer) {
+	if (pacer->period == 0)
+		return;
+
+	uint64_t now = now_ns();
+	if (pacer->frames == 0)
+		pacer->start = now;
+
+	uint64_t due = pacer->start + pacer->frames * pacer->period;
+	if (now < due) {
+		struct timespec ts = {(due - now) / 1000000000, (due - now) % 1000000000};
+		nanosleep(&ts, NULL);
+	}
+	pacer->frames++;
+}
+
+/*
+xorshift64*, fast and the same on every machine
+*/
+static inline uint64_t next_random(uint64_t* state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static double random_range(uint64_t* state, double low, double high) {
+	return low + (high - low) * (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static char is_pixel_map(const char* name) {
+	const char* dot = strrchr(name, '.');
+	return dot && (strcmp(dot, ".ppm") == 0 || strcmp(dot, ".pgm") == 0 || strcmp(dot, ".pnm") == 0);
+}
+
+static int compare_names(const void* a, const void* b) {
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static Image* sequence_read_frame(Device* dev) {
+	struct sequence* seq = dev->backend;
+
+	if (seq->ended)
+		return NULL;
+
+	if (seq->next == seq->amount) {
+		if (!seq->loop)
+			return NULL;
+		seq->next = 0;
+	}
+
+	pace(&seq->pacer);
+	const char* file 	= seq->files[seq->next++];
+	Image* 		img 	= read_pixel_map(file);
+
+	// the sequence ends there, looping or not
+	if (img && (img->channels != seq->channels || img->width != dev->width || img->height != dev->height)) {
+		fprintf(stderr, "%s does not have the shape of the first pixel map\n", file);
+		free_image(img);
+		img = NULL;
+	}
+	if (img == NULL)
+		seq->ended = 1;
+	return img;
+}
+
+static void sequence_free(Device* dev) {
+	struct sequence* seq = dev->backend;
+	for (size_t i = 0; i < seq->amount; i++)
+		free(seq->files[i]);
+	free(seq->files);
+	free(seq);
+	free(dev);
+}
+
+static const struct device_ops sequence_ops = {
+	sequence_read_frame,
+	sequence_free,
+};
+
+/*
+draws the blobs over a black background, then moves them bouncing off the borders
+*/
+static Image* synthetic_read_frame(Device* dev) {
+	struct synthetic* 	syn = dev->backend;
+	Image* 				img = make_image(3, dev->width, dev->height);
+
+	pace(&syn->pacer);
+
+	for (size_t b = 0; b < syn->amount; b++) {
+		struct blob* blob = &syn->blobs[b];
+
+		size_t x0 = MAX(0, blob->x - blob->radius);
+		size_t y0 = MAX(0, blob->y - blob->radius);
+		size_t x1 = MIN(img->width, blob->x + blob->radius +1);
+		size_t y1 = MIN(img->height, blob->y + blob->radius +1);
+
+		for (size_t y = y0; y < y1; y++) {
+			value_t* row = IMAGE_ROW(img, y);
+			for (size_t x = x0; x < x1; x++) {
+				double dx = x - blob->x, dy = y - blob->y;
+				if (dx * dx + dy * dy <= blob->radius * blob->radius)
+					memcpy(row + x * 3, blob->color, 3);
+			}
+		}
+
+		blob->x += blob->dx;
+		blob->y += blob->dy;
+		if (blob->x < 0 || blob->x >= img->width)
+			blob->dx = -blob->dx;
+		if (blob->y < 0 || blob->y >= img->height)
+			blob->dy = -blob->dy;
+	}
+
+	if (syn->noise) {
+		int range = 2 * syn->noise +1;
+		for (size_t y = 0; y < img->height; y++) {
+			value_t* row = IMAGE_ROW(img, y);
+			for (size_t x = 0; x < img->width * 3; x++) {
+				int v = row[x] + (int)(next_random(&syn->state) % range) - syn->noise;
+				row[x] = v < 0 ? 0 : (v > MAX_VALUE ? MAX_VALUE : v);
+			}
+		}
+	}
+
+	return img;
+}
+
+static void synthetic_free(Device* dev) {
+	struct synthetic* syn = dev->backend;
+	free(syn->blobs);
+	free(syn);
+	free(dev);
+}
+
+static const struct device_ops synthetic_ops = {
+	synthetic_read_frame,
+	synthetic_free,
+};
+
+//----------------------------------------------------------------------------------------------------
+
+// VIRTUAL DEVICES
+//----------------------------------------------------------------------------------------------------
+
+/*
+serves the pixel maps of a directory in name order,
+the shape is the one of the first map,
+a map of another shape or that cannot be read ends the sequence even with loop
+*/
+Device* make_sequence_device(const char* directory, double fps, char loop) {
+	DIR* dir = opendir(directory);
+	if (dir == NULL) {
+		fprintf(stderr, "Cannot open directory %s\n", directory);
+		return NULL;
+	}
+
+	struct sequence* 	seq = calloc(1, sizeof(struct sequence));
+	Device* 			dev = calloc(1, sizeof(Device));
+	if (seq == NULL || dev == NULL) {
+		fprintf(stderr, "Cannot allocate device\n");
+		exit(EXIT_FAILURE);
+	}
+
+	struct dirent* entry;
+	while ((entry = readdir(dir))) {
+		if (!is_pixel_map(entry->d_name))
+			continue;
+
+		char* 	path = malloc(strlen(directory) + strlen(entry->d_name) +2);
+		char** 	tmp  = realloc(seq->files, (seq->amount +1) * sizeof(char*));
+		if (path == NULL || tmp == NULL) {
+			fprintf(stderr, "Cannot allocate device\n");
+			exit(EXIT_FAILURE);
+		}
+
+		sprintf(path, "%s/%s", directory, entry->d_name);
+		seq->files = tmp;
+		seq->files[seq->amount++] = path;
+	}
+	closedir(dir);
+
+	qsort(seq->files, seq->amount, sizeof(char*), compare_names);
+
+	Image* first = seq->amount ? read_pixel_map(seq->files[0]) : NULL;
+	if (first == NULL) {
+		fprintf(stderr, "No pixel maps to read in %s\n", directory);
+		dev->backend = seq;
+		sequence_free(dev);
+		return NULL;
+	}
+
+	seq->loop 		= loop;
+	seq->channels 	= first->channels;
+	make_pacer(&seq->pacer, fps);
+
+	dev->ops 		= &sequence_ops;
+	dev->width 		= first->width;
+	dev->height 	= first->height;
+	dev->backend 	= seq;
+
+	free_image(first);
+	return dev;
+}
+
+Device* make_synthetic_device(size_t width, size_t height, struct synthetic_options* options) {
+	struct synthetic* 	syn = calloc(1, sizeof(struct synthetic));
+	Device* 			dev = calloc(1, sizeof(Device));
+	struct blob* 		blobs = calloc(MAX(options->blobs, 1), sizeof(struct blob));
+	if (syn == NULL || dev == NULL || blobs == NULL) {
+		fprintf(stderr, "Cannot allocate device\n");
+		exit(EXIT_FAILURE);
+	}
+
+	syn->state = options->seed ? options->seed : 1;
+
+	double size = MIN(width, height);
+	for (size_t b = 0; b < options->blobs; b++) {
+		blobs[b].x 		= random_range(&syn->state, 0, width);
+		blobs[b].y 		= random_range(&syn->state, 0, height);
+		blobs[b].dx 	= random_range(&syn->state, -size / 50, size / 50);
+		blobs[b].dy 	= random_range(&syn->state, -size / 50, size / 50);
+		blobs[b].radius = random_range(&syn->state, size / 30, size / 8);
+		for (int c = 0; c < 3; c++)
+			blobs[b].color[c] = 64 + next_random(&syn->state) % 192;
+	}
+
+	syn->blobs 		= blobs;
+	syn->amount 	= options->blobs;
+	syn->noise 		= options->noise;
+	make_pacer(&syn->pacer, options->fps);
+
+	dev->ops 		= &synthetic_ops;
+	dev->width 		= width;
+	dev->height 	= height;
+	dev->backend 	= syn;
+
+	return dev;
+}
+
+//----------------------------------------------------------------------------------------------------
@@ -0,0 +1,47 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VIRTUAL_H
+#define VIRTUAL_H
+
+#include "common.h"
+#include "image.h"
+#include "device.h"
+
+/*
+devices that don't need a camera, for tests and benchmarks
+
+fps paces the frames, 0 serves them as fast as they are read
+*/
+
+struct synthetic_options {
+	size_t 		blobs; 	// moving discs of different colors
+	value_t 	noise; 	// amplitude of the noise added to every value
+	double 		fps;
+	uint64_t 	seed; 	// the same seed makes the same frames
+};
+
+// VIRTUAL DEVICES
+//----------------------------------------------------------------------------------------------------
+
+Device* 	make_sequence_device(const char* directory, double fps, char loop);
+Device* 	make_synthetic_device(size_t width, size_t height, struct synthetic_options* options);
+
+//----------------------------------------------------------------------------------------------------
+
+#endif
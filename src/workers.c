@@ -0,0 +1,197 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "workers.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+the calling thread runs the first band and the workers run the rest.
+only one call is dispatched at a time, a call made while the workers are
+busy (from another thread or from inside a band) runs on the caller alone
+*/
+
+struct worker {
+	pthread_t 	thread;
+	size_t 		band;
+};
+
+static struct worker* 	workers 	= NULL;
+static size_t 			count 		= 1; // threads including the caller
+static char 			quit 		= 0;
+
+static band_fn 			job_fn;
+static void* 			job_ctx;
+static size_t 			job_height;
+static size_t 			job_bands;
+static size_t 			generation 	= 0;
+static size_t 			pending 	= 0;
+
+static pthread_mutex_t 	dispatch 	= PTHREAD_MUTEX_INITIALIZER; // held for a whole call
+static pthread_mutex_t 	lock 		= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t 	start 		= PTHREAD_COND_INITIALIZER;
+static pthread_cond_t 	done 		= PTHREAD_COND_INITIALIZER;
+
+// HELPERS
+//----------------------------------------------------------------------------------------------------
+
+static void run_band(band_fn fn, void* ctx, size_t height, size_t bands, size_t band) {
+	size_t y0 = height * band / bands;
+	size_t y1 = height * (band +1) / bands;
+	if (y0 < y1)
+		fn(ctx, y0, y1);
+}
+
+static void* worker_loop(void* arg) {
+	struct worker* self = arg;
+	size_t seen = 0;
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (generation == seen && !quit)
+			pthread_cond_wait(&start, &lock);
+		if (quit)
+			break;
+		seen = generation;
+
+		band_fn fn 		= job_fn;
+		void* 	ctx 	= job_ctx;
+		size_t 	height 	= job_height;
+		size_t 	bands 	= job_bands;
+		pthread_mutex_unlock(&lock);
+
+		if (self->band < bands)
+			run_band(fn, ctx, height, bands, self->band);
+
+		pthread_mutex_lock(&lock);
+		if (--pending == 0)
+			pthread_cond_signal(&done);
+	}
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+static void stop_workers() {
+	pthread_mutex_lock(&lock);
+	quit = 1;
+	pthread_cond_broadcast(&start);
+	pthread_mutex_unlock(&lock);
+
+	for (size_t i = 0; i +1 < count; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	free(workers);
+	workers = NULL;
+	count 	= 1;
+	quit 	= 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+
+// WORKER FUNCTIONS
+//----------------------------------------------------------------------------------------------------
+
+/*
+(re)starts the workers, 0 threads uses every online cpu
+*/
+void workers_init(size_t threads) {
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? cpus : 1;
+	}
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+
+	pthread_mutex_lock(&dispatch);
+	stop_workers();
+
+	if (threads > 1) {
+		workers = calloc(threads -1, sizeof(struct worker));
+		if (workers == NULL) {
+			fprintf(stderr, "Cannot allocate workers\n");
+			exit(EXIT_FAILURE);
+		}
+
+		// seen starts at 0 in every worker
+		generation = 0;
+		for (size_t i = 0; i +1 < threads; i++) {
+			workers[i].band = i +1;
+			if (pthread_create(&workers[i].thread, NULL, worker_loop, &workers[i]) != 0) {
+				fprintf(stderr, "Cannot start worker thread\n");
+				break;
+			}
+			count++;
+		}
+	}
+	pthread_mutex_unlock(&dispatch);
+}
+
+/*
+stops and joins the workers, later calls run on the caller alone until workers_init
+*/
+void workers_shutdown() {
+	pthread_mutex_lock(&dispatch);
+	stop_workers();
+	pthread_mutex_unlock(&dispatch);
+}
+
+size_t workers_count() {
+	return count;
+}
+
+/*
+runs fn over the rows of a width x height image,
+images under PARALLEL_MIN_PIXELS are not worth waking the workers for
+*/
+void workers_run(band_fn fn, void* ctx, size_t width, size_t height) {
+	if (width * height < PARALLEL_MIN_PIXELS || height < 2 || pthread_mutex_trylock(&dispatch) != 0) {
+		fn(ctx, 0, height);
+		return;
+	}
+
+	if (count == 1) {
+		pthread_mutex_unlock(&dispatch);
+		fn(ctx, 0, height);
+		return;
+	}
+
+	size_t bands = count < height ? count : height;
+
+	pthread_mutex_lock(&lock);
+	job_fn 		= fn;
+	job_ctx 	= ctx;
+	job_height 	= height;
+	job_bands 	= bands;
+	pending 	= count -1;
+	generation++;
+	pthread_cond_broadcast(&start);
+	pthread_mutex_unlock(&lock);
+
+	run_band(fn, ctx, height, bands, 0);
+
+	pthread_mutex_lock(&lock);
+	while (pending > 0)
+		pthread_cond_wait(&done, &lock);
+	pthread_mutex_unlock(&lock);
+
+	pthread_mutex_unlock(&dispatch);
+}
+
+//----------------------------------------------------------------------------------------------------
@@ -0,0 +1,41 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include "common.h"
+
+/*
+persistent worker threads running image rows in bands,
+a band function is called with the rows [y0, y1)
+*/
+
+typedef void (*band_fn)(void* ctx, size_t y0, size_t y1);
+
+// WORKER FUNCTIONS
+//----------------------------------------------------------------------------------------------------
+
+void 	workers_init(size_t threads);
+void 	workers_shutdown();
+size_t 	workers_count();
+void 	workers_run(band_fn fn, void* ctx, size_t width, size_t height);
+
+//----------------------------------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,217 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "yuv.h"
+#include "kernel.h"
+#include "workers.h"
+
+#define MIN(MIN_A,MIN_B) (((MIN_A)<(MIN_B))?(MIN_A):(MIN_B))
+
+#define YUV_BLOCK 128 // pixels converted to rgb at once, must be a multiple of 64
+
+// HELPERS
+//----------------------------------------------------------------------------------------------------
+
+/*
+arguments of a conversion, shared by the bands running it
+*/
+struct job {
+	Image* 				img;
+	Image* 				result;
+	Mask* 				mask;
+	enum yuv_format 	format;
+	enum hsv_scale 		scale;
+	value_t* 			lower;
+	value_t* 			upper;
+	size_t 				height; // height of the picture, not of the image
+};
+
+/*
+returns the height of the picture or 0 if img is not of format
+*/
+static size_t picture_height(Image* img, enum yuv_format format) {
+	if (format == YUV_YUYV) {
+		if (img->channels == 2 && img->width % 2 == 0)
+			return img->height;
+		fprintf(stderr, "Must be a YUYV image of an even width\n");
+	}
+	else {
+		if (img->channels == 1 && img->width % 2 == 0 && img->height % 3 == 0)
+			return img->height / 3 * 2;
+		fprintf(stderr, "Must be an NV12 image of an even width and a height divisible by 3\n");
+	}
+	return 0;
+}
+
+/*
+converts n pixels of row i starting at x (even) into rgb
+*/
+static void rgb_block(struct job* job, size_t i, size_t x, size_t n, value_t* rgb) {
+	if (job->format == YUV_YUYV)
+		kernel_yuyv_to_rgb(IMAGE_ROW(job->img, i) + x * 2, rgb, n);
+	else
+		kernel_nv12_to_rgb(IMAGE_ROW(job->img, i) + x, IMAGE_ROW(job->img, job->height + i / 2) + x, rgb, n);
+}
+
+/*
+band functions run the rows [y0, y1) of a conversion (see workers.c)
+*/
+static void gray_band(void* ctx, size_t y0, size_t y1) {
+	struct job* job = ctx;
+	for (size_t i = y0; i < y1; i++) {
+		if (job->format == YUV_YUYV)
+			kernel_yuyv_to_gray(IMAGE_ROW(job->img, i), IMAGE_ROW(job->result, i), job->img->width);
+		else
+			memcpy(IMAGE_ROW(job->result, i), IMAGE_ROW(job->img, i), job->img->width);
+	}
+}
+
+static void rgb_band(void* ctx, size_t y0, size_t y1) {
+	struct job* job = ctx;
+	for (size_t i = y0; i < y1; i++)
+		rgb_block(job, i, 0, job->img->width, IMAGE_ROW(job->result, i));
+}
+
+/*
+hsv is made from small rgb blocks that are still in cache
+*/
+static void hsv_band(void* ctx, size_t y0, size_t y1) {
+	struct job* job = ctx;
+	value_t 	block[YUV_BLOCK * 3];
+
+	for (size_t i = y0; i < y1; i++) {
+		for (size_t x = 0; x < job->img->width; x += YUV_BLOCK) {
+			size_t n = MIN(YUV_BLOCK, job->img->width - x);
+			rgb_block(job, i, x, n, block);
+			kernel_rgb_to_hsv(block, IMAGE_ROW(job->result, i) + x * 3, n, job->scale);
+		}
+	}
+}
+
+/*
+blocks start on whole words of the mask since YUV_BLOCK is a multiple of 64
+*/
+static void hsv_in_range_band(void* ctx, size_t y0, size_t y1) {
+	struct job* job = ctx;
+	value_t 	block[YUV_BLOCK * 3];
+	value_t 	bits[YUV_BLOCK];
+
+	for (size_t i = y0; i < y1; i++) {
+		for (size_t x = 0; x < job->img->width; x += YUV_BLOCK) {
+			size_t n = MIN(YUV_BLOCK, job->img->width - x);
+			rgb_block(job, i, x, n, block);
+			kernel_hsv_in_range(block, bits, n, job->scale, job->lower, job->upper, 1, 0);
+			kernel_pack_mask(bits, MASK_ROW(job->mask, i) + x / 64, n);
+		}
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+
+// CONVERSIONS
+//----------------------------------------------------------------------------------------------------
+
+/*
+the y plane, without any conversion.
+without dst the y plane of an nv12 image is returned as a view on it
+*/
+Image* yuv_to_gray(Image* img, enum yuv_format format) {
+	return yuv_to_gray_into(img, format, NULL);
+}
+
+Image* yuv_to_gray_into(Image* img, enum yuv_format format, Image* dst) {
+	size_t height = picture_height(img, format);
+	if (height == 0)
+		return NULL;
+
+	if (format == YUV_NV12 && dst == NULL)
+		return make_view(img, 0, 0, img->width, height);
+
+	Image* result = prepare_dst(dst, img, NULL, 1, img->width, height);
+	if (result == NULL)
+		return NULL;
+
+	struct job job = {.img = img, .result = result, .format = format, .height = height};
+	workers_run(gray_band, &job, img->width, height);
+
+	return result;
+}
+
+/*
+bt.601 limited range, the range of most cameras
+*/
+Image* yuv_to_rgb(Image* img, enum yuv_format format) {
+	return yuv_to_rgb_into(img, format, NULL);
+}
+
+Image* yuv_to_rgb_into(Image* img, enum yuv_format format, Image* dst) {
+	size_t height = picture_height(img, format);
+	if (height == 0)
+		return NULL;
+
+	Image* result = prepare_dst(dst, img, NULL, 3, img->width, height);
+	if (result == NULL)
+		return NULL;
+
+	struct job job = {.img = img, .result = result, .format = format, .height = height};
+	workers_run(rgb_band, &job, img->width, height);
+
+	return result;
+}
+
+/*
+same as rgb_to_hsv(yuv_to_rgb(img, format), scale) without making the rgb image
+*/
+Image* yuv_to_hsv(Image* img, enum yuv_format format, enum hsv_scale scale) {
+	return yuv_to_hsv_into(img, format, scale, NULL);
+}
+
+Image* yuv_to_hsv_into(Image* img, enum yuv_format format, enum hsv_scale scale, Image* dst) {
+	size_t height = picture_height(img, format);
+	if (height == 0)
+		return NULL;
+
+	Image* result = prepare_dst(dst, img, NULL, 3, img->width, height);
+	if (result == NULL)
+		return NULL;
+
+	struct job job = {.img = img, .result = result, .format = format, .scale = scale, .height = height};
+	workers_run(hsv_band, &job, img->width, height);
+
+	return result;
+}
+
+/*
+same as hsv_in_range_mask(yuv_to_rgb(img, format), ...) without making the rgb image
+*/
+Mask* yuv_hsv_in_range_mask(Image* img, enum yuv_format format, enum hsv_scale scale,
+		value_t* lower, value_t* upper) {
+	size_t height = picture_height(img, format);
+	if (height == 0)
+		return NULL;
+
+	Mask* result = make_mask(img->width, height);
+
+	struct job job = {.img = img, .mask = result, .format = format, .scale = scale,
+		.lower = lower, .upper = upper, .height = height};
+	workers_run(hsv_in_range_band, &job, img->width, height);
+
+	return result;
+}
+
+//----------------------------------------------------------------------------------------------------
@@ -0,0 +1,55 @@
+/*
+Kestrel vision library
+Copyright (C) 2020  Oren Daniel
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef YUV_H
+#define YUV_H
+
+#include "common.h"
+#include "image.h"
+#include "mask.h"
+
+/*
+native camera formats, as read from a device (see device.h)
+
+YUV_YUYV	two channels, channel 0 is y and channel 1 is u for even pixels and v for odd pixels
+YUV_NV12	one channel and 3/2 of the height, the y plane is followed by
+			a plane of interleaved u and v at half the resolution
+
+both need an even width. the y plane of nv12 is the view of the top 2/3 of the image
+*/
+enum yuv_format {
+	YUV_YUYV,
+	YUV_NV12,
+};
+
+// CONVERSIONS
+//----------------------------------------------------------------------------------------------------
+
+Image* 	yuv_to_gray(Image* img, enum yuv_format format);
+Image* 	yuv_to_rgb(Image* img, enum yuv_format format);
+Image* 	yuv_to_hsv(Image* img, enum yuv_format format, enum hsv_scale scale);
+Mask* 	yuv_hsv_in_range_mask(Image* img, enum yuv_format format, enum hsv_scale scale,
+			value_t* lower, value_t* upper);
+
+Image* 	yuv_to_gray_into(Image* img, enum yuv_format format, Image* dst);
+Image* 	yuv_to_rgb_into(Image* img, enum yuv_format format, Image* dst);
+Image* 	yuv_to_hsv_into(Image* img, enum yuv_format format, enum hsv_scale scale, Image* dst);
+
+//----------------------------------------------------------------------------------------------------
+
+#endif